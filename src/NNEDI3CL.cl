@@ -162,9 +162,108 @@ static const char * source =
 "    return mstd3 * SCALE_QUAL;                                                                                                                                                                      \n"
 "}                                                                                                                                                                                                   \n"
 "                                                                                                                                                                                                    \n"
+"#if PQUANT                                                                                                                                                                                          \n"
+"#define WEIGHTS1_T __global const uchar *                                                                                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"#if PQUANT == 1                                                                                                                                                                                     \n"
+"typedef short WTYPE;                                                                                                                                                                                \n"
+"typedef short4 WTYPE4;                                                                                                                                                                              \n"
+"#else                                                                                                                                                                                               \n"
+"typedef char WTYPE;                                                                                                                                                                                 \n"
+"typedef char4 WTYPE4;                                                                                                                                                                               \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
+"#if INT_DOT && defined(__opencl_c_integer_dot_product_input_4x8bit)                                                                                                                                 \n"
+"#define DOT4(a, b) dot(a, b)                                                                                                                                                                        \n"
+"#else                                                                                                                                                                                               \n"
+"static int dot4(const int4 a, const int4 b) {                                                                                                                                                       \n"
+"    const int4 p = a * b;                                                                                                                                                                           \n"
+"    return p.x + p.y + p.z + p.w;                                                                                                                                                                   \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"#define DOT4(a, b) dot4(convert_int4(a), convert_int4(b))                                                                                                                                           \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
+"static float8 predictQuant(const __local float (* input)[INPUT_WIDTH], const __local uchar (* inputq)[INPUT_WIDTH], __global const uchar * weights) {                                               \n"
+"    float8 sum = 0.f, sumsq = 0.f;                                                                                                                                                                  \n"
+"                                                                                                                                                                                                    \n"
+"    #pragma unroll                                                                                                                                                                                  \n"
+"    for (int y = 0; y < YDIA; y++) {                                                                                                                                                                \n"
+"        float8 pixel = vload8(0, input[y]);                                                                                                                                                         \n"
+"                                                                                                                                                                                                    \n"
+"        #pragma unroll                                                                                                                                                                              \n"
+"        for (int x = 0; x < XDIA - 1; x++) {                                                                                                                                                        \n"
+"            sum += pixel;                                                                                                                                                                           \n"
+"            sumsq += pixel * pixel;                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"            pixel = (float8)(pixel.s1234, pixel.s567, input[y][8 + x]);                                                                                                                             \n"
+"        }                                                                                                                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"        sum += pixel;                                                                                                                                                                               \n"
+"        sumsq += pixel * pixel;                                                                                                                                                                     \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    const float8 mstd0 = sum * SCALE_ASIZE;                                                                                                                                                         \n"
+"    float8 mstd1 = sumsq * SCALE_ASIZE - mstd0 * mstd0;                                                                                                                                             \n"
+"    const int8 cond = (mstd1 <= FLT_EPSILON);                                                                                                                                                       \n"
+"    mstd1 = select(native_sqrt(mstd1), 0.f, cond);                                                                                                                                                  \n"
+"    const float8 mstd2 = select(native_recip(mstd1), 0.f, cond);                                                                                                                                    \n"
+"                                                                                                                                                                                                    \n"
+"    float8 mstd3 = 0.f;                                                                                                                                                                             \n"
+"                                                                                                                                                                                                    \n"
+"    #pragma unroll 1                                                                                                                                                                                \n"
+"    for (int q = 0; q < QUAL; q++) {                                                                                                                                                                \n"
+"        __global const WTYPE * ws = (__global const WTYPE *)(weights + mul24(QBLOCK, q));                                                                                                           \n"
+"        __global const float * wf = (__global const float *)(weights + mad24(QBLOCK, q, QWSIZE));                                                                                                   \n"
+"        float8 vsum = 0.f, wsum = 0.f;                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
+"        #pragma unroll 1                                                                                                                                                                            \n"
+"        for (int i = 0; i < NNS; i++) {                                                                                                                                                             \n"
+"            int acc1[8] = { 0 }, acc2[8] = { 0 };                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"            #pragma unroll 1                                                                                                                                                                        \n"
+"            for (int y = 0; y < YDIA; y++) {                                                                                                                                                        \n"
+"                #pragma unroll                                                                                                                                                                      \n"
+"                for (int x = 0; x < XDIA; x += 4) {                                                                                                                                                 \n"
+"                    const int j = mad24(y, XDIA, x);                                                                                                                                                \n"
+"                    const WTYPE4 w1 = vload4(0, ws + mad24(i, ASIZE, j));                                                                                                                           \n"
+"                    const WTYPE4 w2 = vload4(0, ws + mad24(NNS + i, ASIZE, j));                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"                    #pragma unroll                                                                                                                                                                  \n"
+"                    for (int p = 0; p < 8; p++) {                                                                                                                                                   \n"
+"                        const uchar4 pixel = vload4(0, inputq[y] + p + x);                                                                                                                          \n"
+"                        acc1[p] += DOT4(pixel, w1);                                                                                                                                                 \n"
+"                        acc2[p] += DOT4(pixel, w2);                                                                                                                                                 \n"
+"                    }                                                                                                                                                                               \n"
+"                }                                                                                                                                                                                   \n"
+"            }                                                                                                                                                                                       \n"
+"                                                                                                                                                                                                    \n"
+"            float8 sum1 = convert_float8(vload8(0, acc1));                                                                                                                                          \n"
+"            float8 sum2 = convert_float8(vload8(0, acc2));                                                                                                                                          \n"
+"                                                                                                                                                                                                    \n"
+"            sum1 = native_exp(clamp(sum1 * (wf[i] * mstd2) + wf[NNS2 + i], -80.f, 80.f));                                                                                                           \n"
+"            sum2 = sum2 * (wf[NNS + i] * mstd2) + wf[NNS2 + NNS + i];                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"            vsum += sum1 * native_divide(sum2, 1.f + fabs(sum2));                                                                                                                                   \n"
+"            wsum += sum1;                                                                                                                                                                           \n"
+"        }                                                                                                                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"        mstd3 += select(mstd0, native_divide(5.f * vsum, wsum) * mstd1 + mstd0, wsum > 1e-10f);                                                                                                     \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    return mstd3 * SCALE_QUAL;                                                                                                                                                                      \n"
+"}                                                                                                                                                                                                   \n"
+"#else                                                                                                                                                                                               \n"
+"#define WEIGHTS1_T __read_only image1d_buffer_t                                                                                                                                                     \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
 "__kernel __attribute__((reqd_work_group_size(4, 16, 1)))                                                                                                                                            \n"
-"void filter_uint(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights0, __read_only image1d_buffer_t weights1,                                                         \n"
-"                 const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int field_n, const int off, const int swap) {                                              \n"
+"void filter_uint(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights0, WEIGHTS1_T weights1,                                                                           \n"
+"                 const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int field_n, const int off, const int swap                                                 \n"
+"#if MASK                                                                                                                                                                                            \n"
+"                 , __read_only image2d_t mask                                                                                                                                                       \n"
+"#endif                                                                                                                                                                                              \n"
+"                ) {                                                                                                                                                                                 \n"
 "    const int globalX = get_global_id(0);                                                                                                                                                           \n"
 "    const int globalY = get_global_id(1);                                                                                                                                                           \n"
 "    const int localX = get_local_id(0);                                                                                                                                                             \n"
@@ -176,7 +275,54 @@ static const char * source =
 "    const int dstYCopy = off + 2 * globalY;                                                                                                                                                         \n"
 "    const int dstY = field_n + 2 * globalY;                                                                                                                                                         \n"
 "                                                                                                                                                                                                    \n"
+"#if MASK                                                                                                                                                                                            \n"
+"    // Only the pixels whose group of 8 has a non-zero mask pixel go through the network. Work-groups without one skip it entirely.                                                                 \n"
+"    __local int active;                                                                                                                                                                             \n"
+"                                                                                                                                                                                                    \n"
+"    if (localX == 0 && localY == 0)                                                                                                                                                                 \n"
+"        active = 0;                                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"    uint masked = 0;                                                                                                                                                                                \n"
+"    if (dstY < dstHeight) {                                                                                                                                                                         \n"
+"        for (int i = 0; i < 8; i++) {                                                                                                                                                               \n"
+"            const int dstX = _dstX + i;                                                                                                                                                             \n"
+"            if (dstX < dstWidth)                                                                                                                                                                    \n"
+"                masked |= read_imageui(mask, sampler, (int2)(dstX, dstY)).x;                                                                                                                        \n"
+"        }                                                                                                                                                                                           \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    if (masked)                                                                                                                                                                                     \n"
+"        atomic_or(&active, 1);                                                                                                                                                                      \n"
+"    else if (dstY < dstHeight) {                                                                                                                                                                    \n"
+"        for (int i = 0; i < 8; i++) {                                                                                                                                                               \n"
+"            const int dstX = _dstX + i;                                                                                                                                                             \n"
+"            if (dstX < dstWidth) {                                                                                                                                                                  \n"
+"                write_imageui(dst, (int2)(dstX, dstYCopy), read_imageui(src, sampler, (int2)(dstX, dstYCopy)));                                                                                     \n"
+"#if MASK == 1                                                                                                                                                                                       \n"
+"                write_imageui(dst, (int2)(dstX, dstY), read_imageui(src, sampler, (int2)(dstX, dstY)));                                                                                             \n"
+"#else                                                                                                                                                                                               \n"
+"                const float sum = 0.59375f * (read_imageui(src, sampler, (int2)(dstX, clamp(dstY - 1, off, srcHeight - 2 + off))).x +                                                               \n"
+"                                             read_imageui(src, sampler, (int2)(dstX, clamp(dstY + 1, off, srcHeight - 2 + off))).x) -                                                               \n"
+"                                  0.09375f * (read_imageui(src, sampler, (int2)(dstX, clamp(dstY - 3, off, srcHeight - 2 + off))).x +                                                               \n"
+"                                             read_imageui(src, sampler, (int2)(dstX, clamp(dstY + 3, off, srcHeight - 2 + off))).x);                                                                \n"
+"                write_imageui(dst, (int2)(dstX, dstY), clamp((int)(sum + 0.5f), 0, PEAK));                                                                                                          \n"
+"#endif                                                                                                                                                                                              \n"
+"            }                                                                                                                                                                                       \n"
+"        }                                                                                                                                                                                           \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"    if (!active)                                                                                                                                                                                    \n"
+"        return;                                                                                                                                                                                     \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
 "    __local float input[INPUT_HEIGHT][INPUT_WIDTH];                                                                                                                                                 \n"
+"#if PQUANT                                                                                                                                                                                          \n"
+"    __local uchar inputq[INPUT_HEIGHT][INPUT_WIDTH];                                                                                                                                                \n"
+"#endif                                                                                                                                                                                              \n"
 "                                                                                                                                                                                                    \n"
 "    for (int y = localY, j = 0; y < INPUT_HEIGHT; y += 16, j++) {                                                                                                                                   \n"
 "        int srcY = _srcY + Y_STRIDE * j;                                                                                                                                                            \n"
@@ -190,16 +336,30 @@ static const char * source =
 "            if (srcX >= srcWidth)                                                                                                                                                                   \n"
 "                srcX = 2 * srcWidth - srcX - 2;                                                                                                                                                     \n"
 "                                                                                                                                                                                                    \n"
-"            input[y][x] = read_imageui(src, sampler, select((int2)(srcX, srcY), (int2)(srcY, srcX), (int2)swap)).x;                                                                                 \n"
+"            const uint pixel = read_imageui(src, sampler, select((int2)(srcX, srcY), (int2)(srcY, srcX), (int2)swap)).x;                                                                            \n"
+"            input[y][x] = pixel;                                                                                                                                                                    \n"
+"#if PQUANT                                                                                                                                                                                          \n"
+"            inputq[y][x] = (uchar)pixel;                                                                                                                                                            \n"
+"#endif                                                                                                                                                                                              \n"
 "        }                                                                                                                                                                                           \n"
 "    }                                                                                                                                                                                               \n"
 "                                                                                                                                                                                                    \n"
 "    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
 "                                                                                                                                                                                                    \n"
+"#if MASK                                                                                                                                                                                            \n"
+"    if (!masked)                                                                                                                                                                                    \n"
+"        return;                                                                                                                                                                                     \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
 "    int8 flag;                                                                                                                                                                                      \n"
 "    float8 output = PRESCREEN((const __local float (*)[INPUT_WIDTH])&input[YDIAD2M1 - 1 + localY][XDIAD2M1 - PSCRN_OFFSET + 8 * localX], &flag, weights0);                                          \n"
 "    if (!all(flag))                                                                                                                                                                                 \n"
+"#if PQUANT                                                                                                                                                                                          \n"
+"        output = predictQuant((const __local float (*)[INPUT_WIDTH])&input[localY][X_OFFSET + 8 * localX],                                                                                          \n"
+"                              (const __local uchar (*)[INPUT_WIDTH])&inputq[localY][X_OFFSET + 8 * localX], weights1);                                                                              \n"
+"#else                                                                                                                                                                                               \n"
 "        output = predict((const __local float (*)[INPUT_WIDTH])&input[localY][X_OFFSET + 8 * localX], weights1);                                                                                    \n"
+"#endif                                                                                                                                                                                              \n"
 "                                                                                                                                                                                                    \n"
 "    if (dstY < dstHeight) {                                                                                                                                                                         \n"
 "        for (int i = 0; i < 8; i++) {                                                                                                                                                               \n"
@@ -214,7 +374,11 @@ static const char * source =
 "                                                                                                                                                                                                    \n"
 "__kernel __attribute__((reqd_work_group_size(4, 16, 1)))                                                                                                                                            \n"
 "void filter_float(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights0, __read_only image1d_buffer_t weights1,                                                        \n"
-"                  const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int field_n, const int off, const int swap) {                                             \n"
+"                  const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int field_n, const int off, const int swap                                                \n"
+"#if MASK                                                                                                                                                                                            \n"
+"                  , __read_only image2d_t mask                                                                                                                                                      \n"
+"#endif                                                                                                                                                                                              \n"
+"                 ) {                                                                                                                                                                                \n"
 "    const int globalX = get_global_id(0);                                                                                                                                                           \n"
 "    const int globalY = get_global_id(1);                                                                                                                                                           \n"
 "    const int localX = get_local_id(0);                                                                                                                                                             \n"
@@ -226,6 +390,50 @@ static const char * source =
 "    const int dstYCopy = off + 2 * globalY;                                                                                                                                                         \n"
 "    const int dstY = field_n + 2 * globalY;                                                                                                                                                         \n"
 "                                                                                                                                                                                                    \n"
+"#if MASK                                                                                                                                                                                            \n"
+"    // Only the pixels whose group of 8 has a non-zero mask pixel go through the network. Work-groups without one skip it entirely.                                                                 \n"
+"    __local int active;                                                                                                                                                                             \n"
+"                                                                                                                                                                                                    \n"
+"    if (localX == 0 && localY == 0)                                                                                                                                                                 \n"
+"        active = 0;                                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"    int masked = 0;                                                                                                                                                                                 \n"
+"    if (dstY < dstHeight) {                                                                                                                                                                         \n"
+"        for (int i = 0; i < 8; i++) {                                                                                                                                                               \n"
+"            const int dstX = _dstX + i;                                                                                                                                                             \n"
+"            if (dstX < dstWidth)                                                                                                                                                                    \n"
+"                masked |= read_imagef(mask, sampler, (int2)(dstX, dstY)).x != 0.f;                                                                                                                  \n"
+"        }                                                                                                                                                                                           \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    if (masked)                                                                                                                                                                                     \n"
+"        atomic_or(&active, 1);                                                                                                                                                                      \n"
+"    else if (dstY < dstHeight) {                                                                                                                                                                    \n"
+"        for (int i = 0; i < 8; i++) {                                                                                                                                                               \n"
+"            const int dstX = _dstX + i;                                                                                                                                                             \n"
+"            if (dstX < dstWidth) {                                                                                                                                                                  \n"
+"                write_imagef(dst, (int2)(dstX, dstYCopy), read_imagef(src, sampler, (int2)(dstX, dstYCopy)));                                                                                       \n"
+"#if MASK == 1                                                                                                                                                                                       \n"
+"                write_imagef(dst, (int2)(dstX, dstY), read_imagef(src, sampler, (int2)(dstX, dstY)));                                                                                               \n"
+"#else                                                                                                                                                                                               \n"
+"                const float sum = 0.59375f * (read_imagef(src, sampler, (int2)(dstX, clamp(dstY - 1, off, srcHeight - 2 + off))).x +                                                                \n"
+"                                             read_imagef(src, sampler, (int2)(dstX, clamp(dstY + 1, off, srcHeight - 2 + off))).x) -                                                                \n"
+"                                  0.09375f * (read_imagef(src, sampler, (int2)(dstX, clamp(dstY - 3, off, srcHeight - 2 + off))).x +                                                                \n"
+"                                             read_imagef(src, sampler, (int2)(dstX, clamp(dstY + 3, off, srcHeight - 2 + off))).x);                                                                 \n"
+"                write_imagef(dst, (int2)(dstX, dstY), sum);                                                                                                                                         \n"
+"#endif                                                                                                                                                                                              \n"
+"            }                                                                                                                                                                                       \n"
+"        }                                                                                                                                                                                           \n"
+"    }                                                                                                                                                                                               \n"
+"                                                                                                                                                                                                    \n"
+"    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"    if (!active)                                                                                                                                                                                    \n"
+"        return;                                                                                                                                                                                     \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
 "    __local float input[INPUT_HEIGHT][INPUT_WIDTH];                                                                                                                                                 \n"
 "                                                                                                                                                                                                    \n"
 "    for (int y = localY, j = 0; y < INPUT_HEIGHT; y += 16, j++) {                                                                                                                                   \n"
@@ -246,6 +454,11 @@ static const char * source =
 "                                                                                                                                                                                                    \n"
 "    barrier(CLK_LOCAL_MEM_FENCE);                                                                                                                                                                   \n"
 "                                                                                                                                                                                                    \n"
+"#if MASK                                                                                                                                                                                            \n"
+"    if (!masked)                                                                                                                                                                                    \n"
+"        return;                                                                                                                                                                                     \n"
+"#endif                                                                                                                                                                                              \n"
+"                                                                                                                                                                                                    \n"
 "    int8 flag;                                                                                                                                                                                      \n"
 "    float8 output = PRESCREEN((const __local float (*)[INPUT_WIDTH])&input[YDIAD2M1 - 1 + localY][XDIAD2M1 - PSCRN_OFFSET + 8 * localX], &flag, weights0);                                          \n"
 "    if (!all(flag))                                                                                                                                                                                 \n"
@@ -260,4 +473,86 @@ static const char * source =
 "            }                                                                                                                                                                                       \n"
 "        }                                                                                                                                                                                           \n"
 "    }                                                                                                                                                                                               \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void shift_h_uint(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights, const int taps, const int offset,                                                     \n"
+"                           const int width, const int height) {                                                                                                                                     \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    float sum = 0.f;                                                                                                                                                                                \n"
+"    for (int k = 0; k < taps; k++)                                                                                                                                                                  \n"
+"        sum += weights[k] * read_imageui(src, sampler, (int2)(clamp(x + offset + k, 0, width - 1), y)).x;                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"    write_imagef(dst, (int2)(x, y), sum);                                                                                                                                                           \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void shift_v_uint(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights, const int taps, const int offset,                                                     \n"
+"                           const int width, const int height) {                                                                                                                                     \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    float sum = 0.f;                                                                                                                                                                                \n"
+"    for (int k = 0; k < taps; k++)                                                                                                                                                                  \n"
+"        sum += weights[k] * read_imagef(src, sampler, (int2)(x, clamp(y + offset + k, 0, height - 1))).x;                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"    write_imageui(dst, (int2)(x, y), clamp((int)(sum + 0.5f), 0, PEAK));                                                                                                                            \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void shift_h_float(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights, const int taps, const int offset,                                                    \n"
+"                            const int width, const int height) {                                                                                                                                    \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    float sum = 0.f;                                                                                                                                                                                \n"
+"    for (int k = 0; k < taps; k++)                                                                                                                                                                  \n"
+"        sum += weights[k] * read_imagef(src, sampler, (int2)(clamp(x + offset + k, 0, width - 1), y)).x;                                                                                            \n"
+"                                                                                                                                                                                                    \n"
+"    write_imagef(dst, (int2)(x, y), sum);                                                                                                                                                           \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void shift_v_float(__read_only image2d_t src, __write_only image2d_t dst, __constant float * weights, const int taps, const int offset,                                                    \n"
+"                            const int width, const int height) {                                                                                                                                    \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    float sum = 0.f;                                                                                                                                                                                \n"
+"    for (int k = 0; k < taps; k++)                                                                                                                                                                  \n"
+"        sum += weights[k] * read_imagef(src, sampler, (int2)(x, clamp(y + offset + k, 0, height - 1))).x;                                                                                           \n"
+"                                                                                                                                                                                                    \n"
+"    write_imagef(dst, (int2)(x, y), sum);                                                                                                                                                           \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void unpack(__global const PACKED_T * src, const int src_pitch, __write_only image2d_t dst, const int step, const int offset, const int width,                                             \n"
+"                     const int height, const int flip) {                                                                                                                                            \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    write_imageui(dst, (int2)(x, y), (uint4)(src[mad24(flip ? height - 1 - y : y, src_pitch, mad24(x, step, offset))]));                                                                            \n"
+"}                                                                                                                                                                                                   \n"
+"                                                                                                                                                                                                    \n"
+"__kernel void pack(__read_only image2d_t src, __global PACKED_T * dst, const int dst_pitch, const int step, const int offset, const int x0, const int y0,                                           \n"
+"                   const int width, const int height, const int flip) {                                                                                                                             \n"
+"    const int x = get_global_id(0);                                                                                                                                                                 \n"
+"    const int y = get_global_id(1);                                                                                                                                                                 \n"
+"                                                                                                                                                                                                    \n"
+"    if (x >= width || y >= height)                                                                                                                                                                  \n"
+"        return;                                                                                                                                                                                     \n"
+"                                                                                                                                                                                                    \n"
+"    dst[mad24(flip ? height - 1 - y : y, dst_pitch, mad24(x, step, offset))] = (PACKED_T)read_imageui(src, sampler, (int2)(x0 + x, y0 + y)).x;                                                      \n"
 "}                                                                                                                                                                                                   \n";
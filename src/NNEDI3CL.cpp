@@ -1,127 +1,73 @@
-#include <cerrno>
-#include <cstdio>
+#include <climits>
+#include <cstring>
 
-#include <locale>
-#include <memory>
-#include <mutex>
-#include <sstream>
 #include <string>
 
-#ifdef _WIN32
-#ifndef NOMINMAX
-#define NOMINMAX
-#endif
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
-#endif
-
-#define BOOST_COMPUTE_DEBUG_KERNEL_COMPILATION
-#define BOOST_COMPUTE_HAVE_THREAD_LOCAL
-#define BOOST_COMPUTE_THREAD_SAFE
-#define BOOST_COMPUTE_USE_OFFLINE_CACHE
-#include "boost/compute/core.hpp"
-#include "boost/compute/utility/dim.hpp"
-#include "boost/dll.hpp"
-
 #include "avisynth_c.h"
-#include "NNEDI3CL.cl"
-
-static constexpr int numNSIZE{ 7 };
-static constexpr int numNNS{ 5 };
-static constexpr int xdiaTable[numNSIZE]{ 8, 16, 32, 48, 8, 16, 32 };
-static constexpr int ydiaTable[numNSIZE]{ 6, 6, 6, 6, 4, 4, 4 };
-static constexpr int nnsTable[numNNS]{ 16, 32, 64, 128, 256 };
-
-static std::mutex mtx;
+#include "nnedi3cl_core.h"
 
 struct NNEDI3CLData
 {
     AVS_FilterInfo* fi;
     int field;
-    int dh;
-    int dw;
     bool process[4];
-    boost::compute::command_queue queue;
-    boost::compute::kernel kernel;
-    boost::compute::image2d src;
-    boost::compute::image2d dst;
-    boost::compute::image2d tmp;
-    boost::compute::buffer weights0;
-    boost::compute::buffer weights1Buffer;
-    cl_mem weights1;
+    int packed;
+    NNEDI3CL_Context* core;
+    AVS_Clip* mclip;
     std::string err;
-
-    void (*filter)(const AVS_VideoFrame* src, AVS_VideoFrame* dst, const int field_n, const NNEDI3CLData* const __restrict d);
 };
 
-static AVS_FORCEINLINE int roundds(const double f) noexcept
-{
-    return (f - std::floor(f) >= 0.5) ? std::min(static_cast<int>(std::ceil(f)), 32767) : std::max(static_cast<int>(std::floor(f)), -32768);
-}
-
-template<typename T, bool st>
-void filter(const AVS_VideoFrame* src, AVS_VideoFrame* dst, const int field_n, const NNEDI3CLData* const __restrict d)
+static bool filter(const AVS_VideoFrame* src, const AVS_VideoFrame* mask, AVS_VideoFrame* dst, const int field_n, const NNEDI3CLData* const __restrict d)
 {
     constexpr int planes_y[4]{ AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V, AVS_PLANAR_A };
     constexpr int planes_r[4]{ AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B, AVS_PLANAR_A };
     const int* planes{ (avs_is_rgb(&d->fi->vi) ? planes_r : planes_y) };
+    const int size{ avs_component_size(&d->fi->vi) };
 
-    for (int i{ 0 }; i < avs_num_components(&d->fi->vi); ++i)
+    if (d->packed)
     {
-        if (d->process[i])
+        // Packed RGB is stored bottom-up, the core takes the top row with a negative pitch.
+        const bool bottom_up{ d->packed != NNEDI3CL_PACKED_YUY2 };
+        const int step{ avs_bits_per_pixel(&d->fi->vi) / avs_bits_per_component(&d->fi->vi) };
+        const int src_pitch{ avs_get_pitch(src) };
+        const int dst_pitch{ avs_get_pitch(dst) };
+        const uint8_t* srcp{ avs_get_read_ptr(src) + ((bottom_up) ? static_cast<ptrdiff_t>(avs_get_height(src) - 1) * src_pitch : 0) };
+        uint8_t* dstp{ avs_get_write_ptr(dst) + ((bottom_up) ? static_cast<ptrdiff_t>(avs_get_height(dst) - 1) * dst_pitch : 0) };
+
+        if (nnedi3cl_process_packed(d->core, srcp, (bottom_up) ? -src_pitch : src_pitch, avs_get_row_size(src) / (size * step), avs_get_height(src), dstp,
+            (bottom_up) ? -dst_pitch : dst_pitch, field_n))
         {
-            const int src_width{ static_cast<int>(avs_get_row_size_p(src, planes[i]) / sizeof(T)) };
-            const int dst_width{ static_cast<int>(avs_get_row_size_p(dst, planes[i]) / sizeof(T)) };
-            const int src_height{ avs_get_height_p(src, planes[i]) };
-            const int dst_height{ avs_get_height_p(dst, planes[i]) };
-            const T* srcp{ reinterpret_cast<const T*>(avs_get_read_ptr_p(src, planes[i])) };
-            T* __restrict dstp{ reinterpret_cast<T*>(avs_get_write_ptr_p(dst, planes[i])) };
-
-            auto queue{ d->queue };
-            auto kernel{ d->kernel };
-            auto src_image{ d->src };
-            auto dst_image{ d->dst };
-            auto tmp_image{ d->tmp };
-
-            constexpr size_t localWorkSize[2]{ 4, 16 };
-
-            queue.enqueue_write_image(src_image, boost::compute::dim(0, 0), boost::compute::dim(src_width, src_height), srcp, avs_get_pitch_p(src, planes[i]));
+            // Drain the tiles already submitted before the frames are released.
+            nnedi3cl_wait(d->core);
+            return false;
+        }
 
-            if (d->dh && d->dw)
-            {
-                size_t globalWorkSize[]{ static_cast<size_t>(((src_height + 7) / 8 + 3) & -4), static_cast<size_t>((dst_width / 2 + 15) & -16) };
-                kernel.set_args(src_image, tmp_image, d->weights0, d->weights1, src_height, src_width, src_height, dst_width, field_n, 1 - field_n, -1);
-                queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
-
-                globalWorkSize[0] = static_cast<size_t>(((dst_width + 7) / 8 + 3) & -4);
-                globalWorkSize[1] = static_cast<size_t>((dst_height / 2 + 15) & -16);
-                kernel.set_args(tmp_image, dst_image, d->weights0, d->weights1, dst_width, src_height, dst_width, dst_height, field_n, 1 - field_n, 0);
-                queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
-            }
-            else if (d->dw)
-            {
-                const size_t globalWorkSize[]{ static_cast<size_t>(((dst_height + 7) / 8 + 3) & -4), static_cast<size_t>((dst_width / 2 + 15) & -16) };
-                kernel.set_args(src_image, dst_image, d->weights0, d->weights1, src_height, src_width, dst_height, dst_width, field_n, 1 - field_n, -1);
-                queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
-            }
-            else
-            {
-                const size_t globalWorkSize[]{ static_cast<size_t>(((dst_width + 7) / 8 + 3) & -4), static_cast<size_t>((dst_height / 2 + 15) & -16) };
-                kernel.set_args(src_image, dst_image, d->weights0, d->weights1, src_width, src_height, dst_width, dst_height, field_n, 1 - field_n, 0);
-                queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
-            }
+        return true;
+    }
 
-            if constexpr (st)
+    for (int i{ 0 }; i < avs_num_components(&d->fi->vi); ++i)
+    {
+        if (d->process[i])
+        {
+            // The chroma planes use the chroma shifts (see Create_NNEDI3CL), which differ from the luma ones only for subsampled chroma.
+            const int shift_set{ !avs_is_rgb(&d->fi->vi) && (i == 1 || i == 2) };
+            const int ret{ (mask)
+                ? nnedi3cl_submit_plane_masked(d->core, avs_get_read_ptr_p(src, planes[i]), avs_get_pitch_p(src, planes[i]), avs_get_read_ptr_p(mask, planes[i]),
+                    avs_get_pitch_p(mask, planes[i]), avs_get_row_size_p(src, planes[i]) / size, avs_get_height_p(src, planes[i]), avs_get_write_ptr_p(dst, planes[i]),
+                    avs_get_pitch_p(dst, planes[i]), field_n, shift_set)
+                : nnedi3cl_submit_plane(d->core, avs_get_read_ptr_p(src, planes[i]), avs_get_pitch_p(src, planes[i]), avs_get_row_size_p(src, planes[i]) / size,
+                    avs_get_height_p(src, planes[i]), avs_get_write_ptr_p(dst, planes[i]), avs_get_pitch_p(dst, planes[i]), field_n, shift_set) };
+
+            if (ret)
             {
-                std::lock_guard<std::mutex> lck(mtx);
-                queue.enqueue_read_image(dst_image, boost::compute::dim(0, 0), boost::compute::dim(dst_width, dst_height), dstp, avs_get_pitch_p(dst, planes[i]));
+                // Drain the planes already submitted before the frames are released.
+                nnedi3cl_wait(d->core);
+                return false;
             }
-            else
-                queue.enqueue_read_image(dst_image, boost::compute::dim(0, 0), boost::compute::dim(dst_width, dst_height), dstp, avs_get_pitch_p(dst, planes[i]));
         }
     }
+
+    return !nnedi3cl_wait(d->core);
 }
 
 /* multiplies and divides a rational number, such as a frame duration, in place and reduces the result */
@@ -172,6 +118,18 @@ AVS_VideoFrame* AVSC_CC NNEDI3CL_get_frame(AVS_FilterInfo* fi, int n)
     if (!src)
         return nullptr;
 
+    AVS_VideoFrame* mask{ nullptr };
+
+    if (d->mclip)
+    {
+        mask = avs_get_frame(d->mclip, (field > 1) ? (n >> 1) : n);
+        if (!mask)
+        {
+            avs_release_video_frame(src);
+            return nullptr;
+        }
+    }
+
     AVS_VideoFrame* dst{ avs_new_video_frame_p(fi->env, &fi->vi, src) };
 
     if (d->field < 0)
@@ -211,13 +169,14 @@ AVS_VideoFrame* AVSC_CC NNEDI3CL_get_frame(AVS_FilterInfo* fi, int n)
         }
     }
 
-    try
-    {
-        d->filter(src, dst, field, d);
-    }
-    catch (const boost::compute::opencl_error& error)
+    const bool ok{ filter(src, mask, dst, field, d) };
+
+    if (mask)
+        avs_release_video_frame(mask);
+
+    if (!ok)
     {
-        d->err = "NNEDI3CL: " + error.error_string();
+        d->err = std::string{ "NNEDI3CL: " } + nnedi3cl_get_error(d->core);
         fi->error = d->err.c_str();
         avs_release_video_frame(src);
         avs_release_video_frame(dst);
@@ -250,7 +209,11 @@ AVS_VideoFrame* AVSC_CC NNEDI3CL_get_frame(AVS_FilterInfo* fi, int n)
 void AVSC_CC free_NNEDI3CL(AVS_FilterInfo* fi)
 {
     NNEDI3CLData* d{ static_cast<NNEDI3CLData*>(fi->user_data) };
-    clReleaseMemObject(d->weights1);
+    nnedi3cl_free(d->core);
+
+    if (d->mclip)
+        avs_release_clip(d->mclip);
+
     delete d;
 }
 
@@ -261,12 +224,11 @@ int AVSC_CC NNEDI3CL_set_cache_hints(AVS_FilterInfo* fi, int cachehints, int fra
 
 AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
 {
-    enum { Clip, Field, Dh, Dw, Planes, Nsize, Nns, Qual, Etype, Pscrn, Device, List_device, Info, St, Luma };
+    enum { Clip, Field, Dh, Dw, Planes, Nsize, Nns, Qual, Etype, Pscrn, Device, List_device, Info, St, Luma, Pquant, Tile, Mem_budget, Cshift, Chroma_loc, Rfactor, Fission, Mclip, Mmode };
 
     NNEDI3CLData* params{ new NNEDI3CLData() };
 
     AVS_Clip* clip{ avs_new_c_filter(env, &params->fi, avs_array_elt(args, Clip), 1) };
-    const AVS_VideoInfo& vi_temp{ params->fi->vi };
     AVS_Value v{ avs_void };
 
     try
@@ -282,12 +244,24 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
         else
             throw std::string{ "AviSynth+ version must be r3688 or later." };
 
-        if (!avs_is_planar(&params->fi->vi))
-            throw std::string{ "only planar format is supported" };
+        const AVS_VideoInfo* vi{ &params->fi->vi };
+
+        if (avs_is_yuy2(vi))
+            params->packed = NNEDI3CL_PACKED_YUY2;
+        else if (avs_is_rgb24(vi) || avs_is_rgb48(vi))
+            params->packed = NNEDI3CL_PACKED_BGR;
+        else if (avs_is_rgb32(vi) || avs_is_rgb64(vi))
+            params->packed = NNEDI3CL_PACKED_BGRA;
+        else if (!avs_is_planar(vi))
+            throw std::string{ "only planar, YUY2 and packed RGB formats are supported" };
 
         params->field = avs_defined(avs_array_elt(args, Field)) ? avs_as_int(avs_array_elt(args, Field)) : -1;
-        params->dh = avs_defined(avs_array_elt(args, Dh)) ? avs_as_bool(avs_array_elt(args, Dh)) : 0;
-        params->dw = avs_defined(avs_array_elt(args, Dw)) ? avs_as_bool(avs_array_elt(args, Dw)) : 0;
+
+        NNEDI3CL_Params core_params;
+        nnedi3cl_default_params(&core_params);
+
+        core_params.dh = avs_defined(avs_array_elt(args, Dh)) ? avs_as_bool(avs_array_elt(args, Dh)) : 0;
+        core_params.dw = avs_defined(avs_array_elt(args, Dw)) ? avs_as_bool(avs_array_elt(args, Dw)) : 0;
 
         const int num_planes{ (avs_defined(avs_array_elt(args, Planes))) ? avs_array_size(avs_array_elt(args, Planes)) : 0 };
 
@@ -307,8 +281,39 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
             params->process[n] = true;
         }
 
+        if (avs_defined(avs_array_elt(args, Mclip)))
+        {
+            if (core_params.dh || core_params.dw)
+                throw std::string{ "mclip requires dh=False and dw=False" };
+
+            params->mclip = avs_take_clip(avs_array_elt(args, Mclip), env);
+            const AVS_VideoInfo* vi_mask{ avs_get_video_info(params->mclip) };
+
+            if (vi_mask->width != params->fi->vi.width || vi_mask->height != params->fi->vi.height || !avs_is_same_colorspace(vi_mask, &params->fi->vi))
+                throw std::string{ "mclip must have the same dimensions and format as clip" };
+            if (vi_mask->num_frames < params->fi->vi.num_frames)
+                throw std::string{ "mclip must have at least as many frames as clip" };
+
+            core_params.mask = avs_defined(avs_array_elt(args, Mmode)) ? avs_as_int(avs_array_elt(args, Mmode)) : 1;
+
+            if (core_params.mask < 1 || core_params.mask > 2)
+                throw std::string{ "mmode must be 1 or 2" };
+        }
+
+        if (params->packed)
+        {
+            for (int i{ 0 }; i < avs_num_components(&params->fi->vi); ++i)
+            {
+                if (!params->process[i])
+                    throw std::string{ "all planes must be processed for packed formats" };
+            }
+        }
+
         const int onlyY{ (avs_defined(avs_array_elt(args, Luma))) ? avs_as_bool(avs_array_elt(args, Luma)) : 0 };
 
+        if (onlyY && params->packed == NNEDI3CL_PACKED_YUY2)
+            throw std::string{ "luma is not supported for YUY2" };
+
         if (onlyY && !avs_is_rgb(&params->fi->vi))
         {
             if (num_planes > 1)
@@ -318,112 +323,41 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
             params->fi->vi.pixel_type = AVS_CS_GENERIC_Y;
         }
 
-        const int nsize{ avs_defined(avs_array_elt(args, Nsize)) ? avs_as_int(avs_array_elt(args, Nsize)) : 6 };
-        const int nns{ avs_defined(avs_array_elt(args, Nns)) ? avs_as_int(avs_array_elt(args, Nns)) : 1 };
-        const int qual{ avs_defined(avs_array_elt(args, Qual)) ? avs_as_int(avs_array_elt(args, Qual)) : 1 };
-        const int etype{ avs_defined(avs_array_elt(args, Etype)) ? avs_as_int(avs_array_elt(args, Etype)) : 0 };
-        const int pscrn{ avs_defined(avs_array_elt(args, Pscrn)) ? avs_as_int(avs_array_elt(args, Pscrn)) : (avs_component_size(&params->fi->vi) < 4) ? 2 : 1 };
-        const int device_id{ avs_defined(avs_array_elt(args, Device)) ? avs_as_int(avs_array_elt(args, Device)) : -1 };
+        core_params.nsize = avs_defined(avs_array_elt(args, Nsize)) ? avs_as_int(avs_array_elt(args, Nsize)) : core_params.nsize;
+        core_params.nns = avs_defined(avs_array_elt(args, Nns)) ? avs_as_int(avs_array_elt(args, Nns)) : core_params.nns;
+        core_params.qual = avs_defined(avs_array_elt(args, Qual)) ? avs_as_int(avs_array_elt(args, Qual)) : core_params.qual;
+        core_params.etype = avs_defined(avs_array_elt(args, Etype)) ? avs_as_int(avs_array_elt(args, Etype)) : core_params.etype;
+        core_params.pscrn = avs_defined(avs_array_elt(args, Pscrn)) ? avs_as_int(avs_array_elt(args, Pscrn)) : core_params.pscrn;
+        core_params.pquant = avs_defined(avs_array_elt(args, Pquant)) ? avs_as_int(avs_array_elt(args, Pquant)) : core_params.pquant;
+        core_params.device = avs_defined(avs_array_elt(args, Device)) ? avs_as_int(avs_array_elt(args, Device)) : core_params.device;
+        core_params.tile = avs_defined(avs_array_elt(args, Tile)) ? avs_as_int(avs_array_elt(args, Tile)) : core_params.tile;
+        core_params.st = avs_defined(avs_array_elt(args, St)) ? avs_as_bool(avs_array_elt(args, St)) : core_params.st;
+        core_params.fission = avs_defined(avs_array_elt(args, Fission)) ? avs_as_int(avs_array_elt(args, Fission)) : core_params.fission;
 
         if (params->field < -2 || params->field > 3)
             throw std::string{ "field must be -2, -1, 0, 1, 2 or 3" };
-        if (!params->dh && (params->fi->vi.height & 1))
+        if (!core_params.dh && (params->fi->vi.height & 1))
             throw std::string{ "height must be mod 2 when dh=False" };
-        if (params->dh && params->field > 1)
+        if (core_params.dh && params->field > 1)
             throw std::string{ "field must be 0 or 1 when dh=True" };
-        if (params->dw && params->field > 1)
+        if (core_params.dw && params->field > 1)
             throw std::string{ "field must be 0 or 1 when dw=True" };
-        if (nsize < 0 || nsize > 6)
-            throw std::string{ "nsize must be 0, 1, 2, 3, 4, 5 or 6" };
-        if (nns < 0 || nns > 4)
-            throw std::string{ "nns must be 0, 1, 2, 3 or 4" };
-        if (qual < 1 || qual > 2)
-            throw std::string{ "qual must be 1 or 2" };
-        if (etype < 0 || etype > 1)
-            throw std::string{ "etype must be 0 or 1" };
-
-        if (avs_component_size(&params->fi->vi) < 4)
-        {
-            if (pscrn < 1 || pscrn > 2)
-                throw std::string{ "pscrn must be 1 or 2" };
-        }
-        else
-        {
-            if (pscrn != 1)
-                throw std::string{ "pscrn must be 1 for float input" };
-        }
 
-        if (device_id >= static_cast<int>(boost::compute::system::device_count()))
+        if (core_params.device >= nnedi3cl_device_count())
             throw std::string{ "device index out of range" };
 
-        if (avs_defined(avs_array_elt(args, List_device)) ? avs_as_bool(avs_array_elt(args, List_device)) : 0)
-        {
-            const auto devices{ boost::compute::system::devices() };
-
-            for (size_t i{ 0 }; i < devices.size(); ++i)
-                params->err += std::to_string(i) + ": " + devices[i].name() + " (" + devices[i].platform().name() + ")" + "\n";
-
-            AVS_Value cl{ avs_new_value_clip(clip) };
-            AVS_Value args_[2]{ cl , avs_new_value_string(params->err.c_str()) };
-            v = avs_invoke(params->fi->env, "Text", avs_new_value_array(args_, 2), 0);
+        const bool list_device{ avs_defined(avs_array_elt(args, List_device)) ? avs_as_bool(avs_array_elt(args, List_device)) : false };
+        const bool info{ avs_defined(avs_array_elt(args, Info)) ? avs_as_bool(avs_array_elt(args, Info)) : false };
 
-            avs_release_value(cl);
-            avs_release_clip(clip);
-
-            return v;
-        }
-
-        boost::compute::device device{ boost::compute::system::default_device() };
-
-        if (device_id > -1)
-            device = boost::compute::system::devices().at(device_id);
+        if (list_device || info)
+        {
+            params->err.resize(8192);
 
-        boost::compute::context context{ device };
-        params->queue = boost::compute::command_queue{ context, device };
+            const int ret{ (list_device) ? nnedi3cl_list_devices(params->err.data(), params->err.size()) : nnedi3cl_device_info(core_params.device, params->err.data(), params->err.size()) };
+            params->err.resize(std::strlen(params->err.c_str()));
 
-        if (avs_defined(avs_array_elt(args, Info)) ? avs_as_bool(avs_array_elt(args, Info)) : 0)
-        {
-            params->err = "=== Platform Info ===\n";
-            const auto platform{ device.platform() };
-            params->err += "Profile: " + platform.get_info<CL_PLATFORM_PROFILE>() + "\n";
-            params->err += "Version: " + platform.get_info<CL_PLATFORM_VERSION>() + "\n";
-            params->err += "Name: " + platform.get_info<CL_PLATFORM_NAME>() + "\n";
-            params->err += "Vendor: " + platform.get_info<CL_PLATFORM_VENDOR>() + "\n";
-
-            params->err += "\n";
-
-            params->err += "=== Device Info ===\n";
-            params->err += "Name: " + device.get_info<CL_DEVICE_NAME>() + "\n";
-            params->err += "Vendor: " + device.get_info<CL_DEVICE_VENDOR>() + "\n";
-            params->err += "Profile: " + device.get_info<CL_DEVICE_PROFILE>() + "\n";
-            params->err += "Version: " + device.get_info<CL_DEVICE_VERSION>() + "\n";
-            params->err += "Max compute units: " + std::to_string(device.get_info<CL_DEVICE_MAX_COMPUTE_UNITS>()) + "\n";
-            params->err += "Max work-group size: " + std::to_string(device.get_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>()) + "\n";
-            const auto max_work_item_sizes{ device.get_info<CL_DEVICE_MAX_WORK_ITEM_SIZES>() };
-            params->err += "Max work-item sizes: " + std::to_string(max_work_item_sizes[0]) + ", " + std::to_string(max_work_item_sizes[1]) + ", " + std::to_string(max_work_item_sizes[2]) + "\n";
-            params->err += "2D image max width: " + std::to_string(device.get_info<CL_DEVICE_IMAGE2D_MAX_WIDTH>()) + "\n";
-            params->err += "2D image max height: " + std::to_string(device.get_info<CL_DEVICE_IMAGE2D_MAX_HEIGHT>()) + "\n";
-            params->err += "Image support: " + std::string{ device.get_info<CL_DEVICE_IMAGE_SUPPORT>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
-            const auto global_mem_cache_type{ device.get_info<CL_DEVICE_GLOBAL_MEM_CACHE_TYPE>() };
-            if (global_mem_cache_type == CL_NONE)
-                params->err += "Global memory cache type: CL_NONE\n";
-            else if (global_mem_cache_type == CL_READ_ONLY_CACHE)
-                params->err += "Global memory cache type: CL_READ_ONLY_CACHE\n";
-            else if (global_mem_cache_type == CL_READ_WRITE_CACHE)
-                params->err += "Global memory cache type: CL_READ_WRITE_CACHE\n";
-            params->err += "Global memory cache size: " + std::to_string(device.get_info<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE>() / 1024) + " KB\n";
-            params->err += "Global memory size: " + std::to_string(device.get_info<CL_DEVICE_GLOBAL_MEM_SIZE>() / (1024 * 1024)) + " MB\n";
-            params->err += "Max constant buffer size: " + std::to_string(device.get_info<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>() / 1024) + " KB\n";
-            params->err += "Max constant arguments: " + std::to_string(device.get_info<CL_DEVICE_MAX_CONSTANT_ARGS>()) + "\n";
-            params->err += "Local memory type: " + std::string{ device.get_info<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL ? "CL_LOCAL" : "CL_GLOBAL" } + "\n";
-            params->err += "Local memory size: " + std::to_string(device.get_info<CL_DEVICE_LOCAL_MEM_SIZE>() / 1024) + " KB\n";
-            params->err += "Available: " + std::string{ device.get_info<CL_DEVICE_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
-            params->err += "Compiler available: " + std::string{ device.get_info<CL_DEVICE_COMPILER_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
-            params->err += "OpenCL C version: " + device.get_info<CL_DEVICE_OPENCL_C_VERSION>() + "\n";
-            params->err += "Linker available: " + std::string{ device.get_info<CL_DEVICE_LINKER_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
-            params->err += "Image max buffer size: " + std::to_string(device.get_info<size_t>(CL_DEVICE_IMAGE_MAX_BUFFER_SIZE) / 1024) + " KB" + "\n";
-            params->err += "Out of order (on host): " + std::string{ !!(device.get_info<CL_DEVICE_QUEUE_ON_HOST_PROPERTIES>() & 1) ? "CL_TRUE" : "CL_FALSE" } + "\n";
-            params->err += "Out of order (on device): " + std::string{ !!(device.get_info<CL_DEVICE_QUEUE_ON_DEVICE_PROPERTIES>() & 1) ? "CL_TRUE" : "CL_FALSE" };
+            if (ret)
+                throw params->err;
 
             AVS_Value cl{ avs_new_value_clip(clip) };
             AVS_Value args_[2]{ cl, avs_new_value_string(params->err.c_str()) };
@@ -432,6 +366,12 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
             avs_release_value(cl);
             avs_release_clip(clip);
 
+            if (params->mclip)
+            {
+                avs_release_clip(params->mclip);
+                params->mclip = nullptr;
+            }
+
             return v;
         }
 
@@ -449,379 +389,83 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
             params->fi->vi.fps_denominator = static_cast<unsigned>(fps_d);
         }
 
-        if (params->dh)
-            params->fi->vi.height <<= 1;
-
-        if (params->dw)
-            params->fi->vi.width <<= 1;
-
-        const int peak{ (1 << avs_bits_per_component(&params->fi->vi)) - 1 };
-
-        std::string weightsPath{ boost::dll::this_line_location().parent_path().generic_string() + "/nnedi3_weights.bin" };
-
-        FILE* weightsFile{ nullptr };
-#ifdef _WIN32
-        const int requiredSize{ MultiByteToWideChar(CP_UTF8, 0, weightsPath.c_str(), -1, nullptr, 0) };
-        std::unique_ptr<wchar_t[]> wbuffer{ std::make_unique<wchar_t[]>(requiredSize) };
-        MultiByteToWideChar(CP_UTF8, 0, weightsPath.c_str(), -1, wbuffer.get(), requiredSize);
-        weightsFile = _wfopen(wbuffer.get(), L"rb");
-#else
-        weightsFile = std::fopen(weightsPath.c_str(), "rb");
-#endif
-
-#if !defined(_WIN32) && defined(NNEDI3_DATADIR)
-        if (!weightsFile)
-        {
-            weightsPath = std::string{ NNEDI3_DATADIR } + "/nnedi3_weights.bin";
-            weightsFile = std::fopen(weightsPath.c_str(), "rb");
-        }
-#endif
-        if (!weightsFile)
-            throw std::string{ "error opening file " + weightsPath + " (" + std::strerror(errno) + ")" };
-
-        if (std::fseek(weightsFile, 0, SEEK_END))
-        {
-            std::fclose(weightsFile);
-            throw std::string{ "error seeking to the end of file " + weightsPath + " (" + std::strerror(errno) + ")" };
-        }
-
-        constexpr long correctSize{ 13574928 }; // Version 0.9.4 of the Avisynth plugin
-        const long weightsSize{ std::ftell(weightsFile) };
-
-        if (weightsSize == -1)
-        {
-            std::fclose(weightsFile);
-            throw std::string{ "error determining the size of file " + weightsPath + " (" + std::strerror(errno) + ")" };
-        }
-        else if (weightsSize != correctSize)
-        {
-            std::fclose(weightsFile);
-            throw std::string{ "incorrect size of file " + weightsPath + ". Should be " + std::to_string(correctSize) + " bytes, but got " + std::to_string(weightsSize) + " bytes instead" };
-        }
-
-        std::rewind(weightsFile);
-
-        float* bdata{ reinterpret_cast<float*>(malloc(correctSize)) };
-        const size_t bytesRead{ std::fread(bdata, 1, correctSize, weightsFile) };
-
-        if (bytesRead != correctSize)
-        {
-            std::fclose(weightsFile);
-            free(bdata);
-            throw std::string{ "error reading file " + weightsPath + ". Should read " + std::to_string(correctSize) + " bytes, but read " + std::to_string(bytesRead) + " bytes instead" };
-        }
-
-        std::fclose(weightsFile);
-
-        constexpr int dims0{ 49 * 4 + 5 * 4 + 9 * 4 };
-        constexpr int dims0new{ 4 * 65 + 4 * 5 };
-        const int dims1{ nnsTable[nns] * 2 * (xdiaTable[nsize] * ydiaTable[nsize] + 1) };
-        int dims1tsize{ 0 };
-        int dims1offset{ 0 };
-
-        for (int j{ 0 }; j < numNNS; ++j)
-        {
-            for (int i{ 0 }; i < numNSIZE; ++i)
-            {
-                if (i == nsize && j == nns)
-                    dims1offset = dims1tsize;
-
-                dims1tsize += nnsTable[j] * 2 * (xdiaTable[i] * ydiaTable[i] + 1) * 2;
-            }
-        }
-
-        float* weights0{ new float[std::max(dims0, dims0new)] };
-        float* weights1{ new float[dims1 * 2] };
-
-        // Adjust prescreener weights
-        if (pscrn == 2) // using new prescreener
-        {
-            int* offt{ reinterpret_cast<int*>(calloc(4 * 64, sizeof(int))) };
-
-            for (int j{ 0 }; j < 4; ++j)
-            {
-                for (int k{ 0 }; k < 64; ++k)
-                    offt[j * 64 + k] = ((k >> 3) << 5) + ((j & 3) << 3) + (k & 7);
-            }
-
-            const float* bdw{ bdata + dims0 + dims0new * (pscrn - 2) };
-            short* ws{ reinterpret_cast<short*>(weights0) };
-            float* wf{ reinterpret_cast<float*>(&ws[4 * 64]) };
-            double mean[4]{ 0.0, 0.0, 0.0, 0.0 };
+        const char* cshift{ avs_defined(avs_array_elt(args, Cshift)) ? avs_as_string(avs_array_elt(args, Cshift)) : "" };
 
-            // Calculate mean weight of each first layer neuron
-            for (int j{ 0 }; j < 4; ++j)
-            {
-                double cmean{ 0.0 };
-
-                for (int k{ 0 }; k < 64; ++k)
-                    cmean += bdw[offt[j * 64 + k]];
-
-                mean[j] = cmean / 64.0;
-            }
-
-            const double half{ peak / 2.0 };
-
-            // Factor mean removal and 1.0/half scaling into first layer weights. scale to int16 range
-            for (int j{ 0 }; j < 4; ++j)
-            {
-                double mval{ 0.0 };
-                for (int k{ 0 }; k < 64; ++k)
-                    mval = std::max(mval, std::abs((bdw[offt[j * 64 + k]] - mean[j]) / half));
-
-                const double scale{ 32767.0 / mval };
-
-                for (int k{ 0 }; k < 64; ++k)
-                    ws[offt[j * 64 + k]] = roundds(((bdw[offt[j * 64 + k]] - mean[j]) / half) * scale);
-
-                wf[j] = static_cast<float>(mval / 32767.0);
-            }
-
-            memcpy(wf + 4, bdw + 4 * 64, (dims0new - 4 * 64) * sizeof(float));
-            free(offt);
-        }
-        else // using old prescreener
+        if (cshift[0])
         {
-            double mean[4]{ 0.0, 0.0, 0.0, 0.0 };
-
-            // Calculate mean weight of each first layer neuron
-            for (int j{ 0 }; j < 4; ++j)
+            const std::string chroma_loc{ avs_defined(avs_array_elt(args, Chroma_loc)) ? avs_as_string(avs_array_elt(args, Chroma_loc)) : "left" };
+            const int rfactor{ avs_defined(avs_array_elt(args, Rfactor)) ? avs_as_int(avs_array_elt(args, Rfactor)) : 2 };
+
+            if (!core_params.dh && !core_params.dw)
+                throw std::string{ "cshift requires dh=True or dw=True" };
+            if (chroma_loc != "left" && chroma_loc != "center")
+                throw std::string{ "chroma_loc must be either left or center" };
+            if (rfactor < 2 || (rfactor & (rfactor - 1)))
+                throw std::string{ "rfactor must be a power of 2 greater than 1" };
+            if (params->field != 0 && params->field != 1)
+                throw std::string{ "cshift requires field=0 or field=1" };
+
+            // The same shifts NNEDI3CL_rpow2 corrected with avsresize, rfactor being the enlargement of the whole chain.
+            const double shift{ ((params->field) ? -0.5 : 0.5) * (rfactor - 1) };
+            double shift_chroma{ shift };
+
+            if (avs_is_420(&params->fi->vi) || avs_is_422(&params->fi->vi) || params->packed == NNEDI3CL_PACKED_YUY2)
             {
-                double cmean{ 0.0 };
-
-                for (int k{ 0 }; k < 48; ++k)
-                    cmean += bdata[j * 48 + k];
-
-                mean[j] = cmean / 48.0;
+                int log2_rfactor{ 0 };
+                while ((1 << log2_rfactor) < rfactor)
+                    ++log2_rfactor;
+
+                if (params->field)
+                    shift_chroma = ((chroma_loc == "left") ? shift : -(rfactor - 1)) / 2.0;
+                else if (chroma_loc == "left")
+                    shift_chroma = 0.5 * (rfactor * log2_rfactor + 1) / 2.0;
             }
 
-            const double half{ ((avs_component_size(&params->fi->vi) < 4) ? peak : 1.0) / 2.0 };
-
-            // Factor mean removal and 1.0/half scaling into first layer weights
-            for (int j{ 0 }; j < 4; ++j)
-            {
-                for (int k{ 0 }; k < 48; ++k)
-                    weights0[j * 48 + k] = static_cast<float>((bdata[j * 48 + k] - mean[j]) / half);
-            }
-
-            memcpy(weights0 + 4 * 48, bdata + 4 * 48, (dims0 - 4 * 48) * sizeof(float));
+            core_params.cshift = cshift;
+            core_params.shift_x[0] = (core_params.dw) ? shift : 0.0;
+            core_params.shift_x[1] = (core_params.dw) ? shift_chroma : 0.0;
+            core_params.shift_y[0] = (core_params.dh) ? shift : 0.0;
+            core_params.shift_y[1] = (core_params.dh) ? shift : 0.0;
         }
 
-        // Adjust prediction weights
-        for (int i{ 0 }; i < 2; ++i)
-        {
-            const float* bdataT{ bdata + dims0 + dims0new * 3 + dims1tsize * etype + dims1offset + i * dims1 };
-            float* weightsT{ weights1 + i * dims1 };
-            const int nnst{ nnsTable[nns] };
-            const int asize{ xdiaTable[nsize] * ydiaTable[nsize] };
-            const int boff{ nnst * 2 * asize };
-            double* mean{ reinterpret_cast<double*>(calloc(asize + 1 + nnst * 2, sizeof(double))) };
-
-            // Calculate mean weight of each neuron (ignore bias)
-            for (int j{ 0 }; j < nnst * 2; ++j)
-            {
-                double cmean{ 0.0 };
-
-                for (int k{ 0 }; k < asize; ++k)
-                    cmean += bdataT[j * asize + k];
+        core_params.packed = params->packed;
+        core_params.width = params->fi->vi.width;
+        core_params.height = params->fi->vi.height;
+        core_params.bits_per_sample = avs_bits_per_component(&params->fi->vi);
 
-                mean[asize + 1 + j] = cmean / asize;
-            }
-
-            // Calculate mean softmax neuron
-            for (int j{ 0 }; j < nnst; ++j)
-            {
-                for (int k{ 0 }; k < asize; ++k)
-                    mean[k] += bdataT[j * asize + k] - mean[asize + 1 + j];
-
-                mean[asize] += bdataT[boff + j];
-            }
-
-            for (int j{ 0 }; j < asize + 1; ++j)
-                mean[j] /= nnst;
-
-            // Factor mean removal into weights, and remove global offset from softmax neurons
-            for (int j{ 0 }; j < nnst * 2; ++j)
-            {
-                for (int k{ 0 }; k < asize; ++k)
-                {
-                    const double q{ (j < nnst) ? mean[k] : 0.0 };
-                    weightsT[j * asize + k] = static_cast<float>(bdataT[j * asize + k] - mean[asize + 1 + j] - q);
-                }
+        if (core_params.dh)
+            params->fi->vi.height <<= 1;
 
-                weightsT[boff + j] = static_cast<float>(bdataT[boff + j] - (j < nnst ? mean[asize] : 0.0));
-            }
+        if (core_params.dw)
+            params->fi->vi.width <<= 1;
 
-            free(mean);
-        }
+        char err[1024];
 
-        free(bdata);
-
-        const int xdia{ xdiaTable[nsize] };
-        const int ydia{ ydiaTable[nsize] };
-        const int asize{ xdiaTable[nsize] * ydiaTable[nsize] };
-        const int xdiad2m1{ std::max(xdia, (pscrn == 1) ? 12 : 16) / 2 - 1 };
-        const int ydiad2m1{ ydia / 2 - 1 };
-        const int xOffset{ (xdia == 8) ? (pscrn == 1 ? 2 : 4) : 0 };
-        const int inputWidth{ std::max(xdia, (pscrn == 1) ? 12 : 16) + 32 - 1 };
-        const int inputHeight{ ydia + 16 - 1 };
-        const float scaleAsize{ 1.0f / asize };
-        const float scaleQual{ 1.0f / qual };
-
-        params->weights0 = boost::compute::buffer{ context, std::max(dims0, dims0new) * sizeof(cl_float), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights0 };
-        params->weights1Buffer = boost::compute::buffer{ context, dims1 * 2 * sizeof(cl_float), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights1 };
-        delete[] weights0;
-        delete[] weights1;
-
-        if (static_cast<size_t>(dims1 * 2) > device.get_info<size_t>(CL_DEVICE_IMAGE_MAX_BUFFER_SIZE))
-            throw std::string{ "the device's image max buffer size is too small. Reduce nsize/nns...or buy a new graphics card" };
-
-        boost::compute::program program;
-        try
+        if (avs_defined(avs_array_elt(args, Mem_budget)))
         {
-            std::ostringstream options;
-            options.imbue(std::locale{ "C" });
-            options.precision(16);
-            options.setf(std::ios::fixed, std::ios::floatfield);
-            options << "-cl-denorms-are-zero -cl-fast-relaxed-math -Werror";
-            options << " -D QUAL=" << qual;
-            if (pscrn == 1)
-            {
-                options << " -D PRESCREEN=prescreenOld";
-                options << " -D USE_OLD_PSCRN=1";
-                options << " -D USE_NEW_PSCRN=0";
-            }
-            else
-            {
-                options << " -D PRESCREEN=prescreenNew";
-                options << " -D USE_OLD_PSCRN=0";
-                options << " -D USE_NEW_PSCRN=1";
-            }
-            options << " -D PSCRN_OFFSET=" << (pscrn == 1 ? 5 : 6);
-            options << " -D DIMS1=" << dims1;
-            options << " -D NNS=" << nnsTable[nns];
-            options << " -D NNS2=" << (nnsTable[nns] * 2);
-            options << " -D XDIA=" << xdia;
-            options << " -D YDIA=" << ydia;
-            options << " -D ASIZE=" << asize;
-            options << " -D XDIAD2M1=" << xdiad2m1;
-            options << " -D YDIAD2M1=" << ydiad2m1;
-            options << " -D X_OFFSET=" << xOffset;
-            options << " -D INPUT_WIDTH=" << inputWidth;
-            options << " -D INPUT_HEIGHT=" << inputHeight;
-            options << " -D SCALE_ASIZE=" << scaleAsize << "f";
-            options << " -D SCALE_QUAL=" << scaleQual << "f";
-            options << " -D PEAK=" << peak;
-            if (!(params->dh || params->dw))
-            {
-                options << " -D Y_OFFSET=" << (ydia - 1);
-                options << " -D Y_STEP=2";
-                options << " -D Y_STRIDE=32";
-            }
-            else
-            {
-                options << " -D Y_OFFSET=" << (ydia / 2);
-                options << " -D Y_STEP=1";
-                options << " -D Y_STRIDE=16";
-            }
+            const int mem_budget{ avs_as_int(avs_array_elt(args, Mem_budget)) };
 
-            program = boost::compute::program::build_with_source(source, context, options.str());
-        }
-        catch (const boost::compute::opencl_error& error)
-        {
-            throw error.error_string() + "\n" + program.build_log();
-        }
+            if (mem_budget < 0)
+                throw std::string{ "mem_budget must be greater than or equal to 0" };
 
-        if (avs_component_size(&params->fi->vi) < 4)
-            params->kernel = program.create_kernel("filter_uint");
-        else
-            params->kernel = program.create_kernel("filter_float");
-
-        const int st{ avs_defined(avs_array_elt(args, St)) ? avs_as_bool(avs_array_elt(args, St)) : !!(device.get_info<CL_DEVICE_QUEUE_ON_HOST_PROPERTIES>() & 1) };
-        cl_image_format imageFormat;
-
-        switch (avs_component_size(&params->fi->vi))
-        {
-            case 1:
-            {
-                imageFormat = { CL_R, CL_UNSIGNED_INT8 };
-                params->filter = (st) ? filter<uint8_t, true> : filter<uint8_t, false>;
-                break;
-            }
-            case 2:
-            {
-                imageFormat = { CL_R, CL_UNSIGNED_INT16 };
-                params->filter = (st) ? filter<uint16_t, true> : filter<uint16_t, false>;
-                break;
-            }
-            default:
-            {
-                imageFormat = { CL_R, CL_FLOAT };
-                params->filter = (st) ? filter<float, true> : filter<float, false>;
-            }
+            if (nnedi3cl_set_memory_budget(core_params.device, static_cast<unsigned long long>(mem_budget) << 20, err, sizeof(err)))
+                throw std::string{ err };
         }
 
-        params->src = boost::compute::image2d{ context,
-                                   static_cast<size_t>(vi_temp.width),
-                                   static_cast<size_t>(vi_temp.height),
-                                   boost::compute::image_format{ imageFormat },
-                                   CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY };
-
-        params->dst = boost::compute::image2d{ context,
-                                   static_cast<size_t>(std::max(params->fi->vi.width, params->fi->vi.height)),
-                                   static_cast<size_t>(std::max(params->fi->vi.width, params->fi->vi.height)),
-                                   boost::compute::image_format{ imageFormat },
-                                   CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY };
-
-        params->tmp = (params->dh && params->dw) ? boost::compute::image2d{ context,
-                                                      static_cast<size_t>(std::max(params->fi->vi.width, params->fi->vi.height)),
-                                                      static_cast<size_t>(std::max(params->fi->vi.width, params->fi->vi.height)),
-                                                      boost::compute::image_format{ imageFormat },
-                                                      CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS }
-        : boost::compute::image2d{};
-
-        {
-            constexpr cl_image_format format{ CL_R, CL_FLOAT };
-
-            cl_image_desc desc;
-            desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
-            desc.image_width = dims1 * 2;
-            desc.image_height = 1;
-            desc.image_depth = 1;
-            desc.image_array_size = 0;
-            desc.image_row_pitch = 0;
-            desc.image_slice_pitch = 0;
-            desc.num_mip_levels = 0;
-            desc.num_samples = 0;
-#ifdef BOOST_COMPUTE_CL_VERSION_2_0
-            desc.mem_object = params->weights1Buffer.get();
-#else
-            desc.buffer = d->weights1Buffer.get();
-#endif
-
-            cl_int error{ 0 };
-
-            cl_mem mem{ clCreateImage(context, 0, &format, &desc, nullptr, &error) };
-            if (!mem)
-                BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
-
-            params->weights1 = mem;
-        }
+        params->core = nnedi3cl_create(&core_params, err, sizeof(err));
+        if (!params->core)
+            throw std::string{ err };
     }
     catch (const std::string& error)
     {
         params->err = "NNEDI3CL: " + error;
         v = avs_new_value_error(params->err.c_str());
-    }
-    catch (const boost::compute::no_device_found& error)
-    {
-        params->err = std::string{ "NNEDI3CL: " } + error.what();
-        v = avs_new_value_error(params->err.c_str());
-    }
-    catch (const boost::compute::opencl_error& error)
-    {
-        params->err = "NNEDI3CL: " + error.error_string();
-        v = avs_new_value_error(params->err.c_str());
+
+        if (params->mclip)
+        {
+            avs_release_clip(params->mclip);
+            params->mclip = nullptr;
+        }
     }
 
     if (!avs_defined(v))
@@ -841,6 +485,6 @@ AVS_Value AVSC_CC Create_NNEDI3CL(AVS_ScriptEnvironment* env, AVS_Value args, vo
 
 const char* AVSC_CC avisynth_c_plugin_init(AVS_ScriptEnvironment* env)
 {
-    avs_add_function(env, "NNEDI3CL", "c[field]i[dh]b[dw]b[planes]i*[nsize]i[nns]i[qual]i[etype]i[pscrn]i[device]i[list_device]b[info]b[st]b[luma]b", Create_NNEDI3CL, 0);
+    avs_add_function(env, "NNEDI3CL", "c[field]i[dh]b[dw]b[planes]i*[nsize]i[nns]i[qual]i[etype]i[pscrn]i[device]i[list_device]b[info]b[st]b[luma]b[pquant]i[tile]i[mem_budget]i[cshift]s[chroma_loc]s[rfactor]i[fission]i[mclip]c[mmode]i", Create_NNEDI3CL, 0);
     return "NNEDI3CL";
 }
@@ -0,0 +1,1890 @@
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <locale>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#define BOOST_COMPUTE_DEBUG_KERNEL_COMPILATION
+#define BOOST_COMPUTE_HAVE_THREAD_LOCAL
+#define BOOST_COMPUTE_THREAD_SAFE
+#define BOOST_COMPUTE_USE_OFFLINE_CACHE
+#include "boost/compute/core.hpp"
+#include "boost/compute/utility/dim.hpp"
+#include "boost/dll.hpp"
+
+#include "nnedi3cl_core.h"
+#include "NNEDI3CL.cl"
+
+static constexpr int numNSIZE{ 7 };
+static constexpr int numNNS{ 5 };
+static constexpr int xdiaTable[numNSIZE]{ 8, 16, 32, 48, 8, 16, 32 };
+static constexpr int ydiaTable[numNSIZE]{ 6, 6, 6, 6, 4, 4, 4 };
+static constexpr int nnsTable[numNNS]{ 16, 32, 64, 128, 256 };
+
+static std::mutex mtx;
+
+// A buffer holds width x height elements of bytes_per_pixel (format is unused).
+struct ImageDesc
+{
+    size_t width;
+    size_t height;
+    size_t bytes_per_pixel;
+    cl_image_format format;
+    cl_mem_flags flags;
+    bool buffer{ false };
+
+    size_t size() const noexcept
+    {
+        return width * height * bytes_per_pixel;
+    }
+
+    bool operator==(const ImageDesc& other) const noexcept
+    {
+        return width == other.width && height == other.height && bytes_per_pixel == other.bytes_per_pixel && format.image_channel_order == other.format.image_channel_order &&
+            format.image_channel_data_type == other.format.image_channel_data_type && flags == other.flags && buffer == other.buffer;
+    }
+};
+
+// An image or buffer owned by the pool (boost::compute::memory_object itself can't be constructed).
+class PoolMemory : public boost::compute::memory_object
+{
+public:
+    PoolMemory() = default;
+
+    explicit PoolMemory(const boost::compute::memory_object& mem)
+        : memory_object{ mem }
+    {
+    }
+};
+
+/* Process-wide governor of the device memory used by all contexts on one device.
+   The contexts share one OpenCL context, so the images of an idle context can be recycled by the others.
+   Working-set images are leased for the duration of a frame. A lease that would exceed the budget first evicts idle images
+   and then waits until another lease is returned. Waiting leases are granted in arrival order. It never waits when no other lease is active,
+   so a single context always makes progress.
+   With fission the device is partitioned into sub-devices (all in the same OpenCL context) and each context runs on its own sub-device. */
+class DevicePool
+{
+public:
+    boost::compute::context context;
+
+    DevicePool(const boost::compute::device& device, const cl_ulong budget)
+        : device_mem_{ device.get_info<cl_ulong>(CL_DEVICE_GLOBAL_MEM_SIZE) }, device_{ device }
+    {
+        budget_ = (budget) ? budget : device_mem_ / 4 * 3;
+    }
+
+    /* Creates the OpenCL context on the first call and returns the device a new context runs on.
+       fission: 0: the whole device, > 0: sub-devices of that many compute units, -1: one sub-device per affinity domain (e.g. NUMA node).
+       The sub-device used by the fewest contexts is returned. */
+    boost::compute::device open(const int fission)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (!context.get())
+        {
+            // Nothing is kept if partitioning or the context creation fails.
+            std::vector<boost::compute::device> devices{ device_ };
+
+            if (fission)
+            {
+                if (!device_.get_info<cl_uint>(CL_DEVICE_PARTITION_MAX_SUB_DEVICES))
+                    throw std::string{ "the device doesn't support fission" };
+
+                devices = (fission > 0) ? device_.partition_equally(fission) : device_.partition_by_affinity_domain(CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE);
+            }
+
+            context = boost::compute::context{ devices };
+            devices_ = std::move(devices);
+            users_.assign(devices_.size(), 0);
+            fission_ = fission;
+        }
+        else if (fission != fission_)
+            throw std::string{ "fission must be the same for all instances on the device" };
+
+        const size_t i{ static_cast<size_t>(std::min_element(users_.begin(), users_.end()) - users_.begin()) };
+        ++users_[i];
+
+        return devices_[i];
+    }
+
+    /* When the last context is closed the OpenCL context and the sub-devices are dropped, so the next open can use another fission
+       (e.g. after a script reload or a failed first create). The idle images belong to the dropped context and are freed too. */
+    void close(const boost::compute::device& device)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        for (size_t i{ 0 }; i < devices_.size(); ++i)
+        {
+            if (devices_[i] == device)
+                --users_[i];
+        }
+
+        if (active_ || std::any_of(users_.begin(), users_.end(), [](const int users) { return users > 0; }))
+            return;
+
+        for (const auto& item : free_)
+            allocated_ -= item.first.size();
+
+        free_.clear();
+        context = boost::compute::context{};
+        devices_.clear();
+        users_.clear();
+        fission_ = 0;
+    }
+
+    // Returns the number of compute units of each sub-device and how many contexts use it.
+    std::vector<std::pair<cl_uint, int>> partitions()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        std::vector<std::pair<cl_uint, int>> result;
+
+        if (fission_)
+        {
+            for (size_t i{ 0 }; i < devices_.size(); ++i)
+                result.emplace_back(devices_[i].compute_units(), users_[i]);
+        }
+
+        return result;
+    }
+
+    /* The registry holds only weak references, so the pool (with its OpenCL context, sub-devices and images) is destroyed
+       together with the last context using it instead of at static destruction, when the OpenCL runtime may already be gone.
+       The budget set by nnedi3cl_set_memory_budget is kept separately so it outlives the pools. */
+    static std::shared_ptr<DevicePool> get(const boost::compute::device& device)
+    {
+        std::lock_guard<std::mutex> lck(registry_mtx());
+        auto& entry{ registry()[device.id()] };
+        std::shared_ptr<DevicePool> pool{ entry.pool.lock() };
+
+        if (!pool)
+        {
+            pool = std::make_shared<DevicePool>(device, entry.budget);
+            entry.pool = pool;
+        }
+
+        return pool;
+    }
+
+    // bytes = 0: 3/4 of the device memory.
+    static void set_budget(const boost::compute::device& device, const cl_ulong bytes)
+    {
+        std::shared_ptr<DevicePool> pool;
+
+        {
+            std::lock_guard<std::mutex> lck(registry_mtx());
+            auto& entry{ registry()[device.id()] };
+            entry.budget = bytes;
+            pool = entry.pool.lock();
+        }
+
+        if (pool)
+        {
+            std::lock_guard<std::mutex> lck(pool->mtx_);
+            pool->budget_ = (bytes) ? bytes : pool->device_mem_ / 4 * 3;
+            pool->cv_.notify_all();
+        }
+    }
+
+    cl_ulong budget()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return budget_;
+    }
+
+    void stats(NNEDI3CL_MemoryStats* stats)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        stats->budget = budget_;
+        stats->allocated = allocated_;
+        stats->peak = peak_;
+        stats->waits = waits_;
+    }
+
+    // Accounts for memory that lives as long as the context (the weights).
+    void reserve(const cl_ulong bytes)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        allocated_ += bytes;
+        peak_ = std::max(peak_, allocated_);
+    }
+
+    void unreserve(const cl_ulong bytes)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        allocated_ -= bytes;
+        cv_.notify_all();
+    }
+
+    std::vector<PoolMemory> acquire(const std::vector<ImageDesc>& descs)
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        std::vector<PoolMemory> images(descs.size());
+
+        // Leases are granted in arrival order, so a context that returns its lease and takes it again right away can't starve a waiter.
+        const cl_ulong ticket{ next_ticket_++ };
+        bool waited{ false };
+
+        for (;;)
+        {
+            if (ticket == serving_)
+            {
+                cl_ulong missing{ 0 };
+                std::vector<bool> taken(free_.size());
+
+                for (const auto& desc : descs)
+                {
+                    size_t i{ 0 };
+                    while (i < free_.size() && (taken[i] || !(free_[i].first == desc)))
+                        ++i;
+
+                    if (i < free_.size())
+                        taken[i] = true;
+                    else
+                        missing += desc.size();
+                }
+
+                // Evict idle images that this lease can't reuse.
+                for (size_t i{ free_.size() }; i-- > 0 && allocated_ + missing > budget_;)
+                {
+                    if (!taken[i])
+                    {
+                        allocated_ -= free_[i].first.size();
+                        free_.erase(free_.begin() + i);
+                        taken.erase(taken.begin() + i);
+                    }
+                }
+
+                if (allocated_ + missing <= budget_ || !active_)
+                    break;
+            }
+
+            waited = true;
+            cv_.wait(lck);
+        }
+
+        waits_ += waited;
+        ++serving_;
+        cv_.notify_all();
+
+        for (size_t j{ 0 }; j < descs.size(); ++j)
+        {
+            auto it{ std::find_if(free_.begin(), free_.end(), [&](const auto& item) { return item.first == descs[j]; }) };
+
+            if (it != free_.end())
+            {
+                images[j] = it->second;
+                free_.erase(it);
+            }
+            else
+            {
+                if (descs[j].buffer)
+                    images[j] = PoolMemory{ boost::compute::buffer{ context, descs[j].size(), descs[j].flags } };
+                else
+                    images[j] = PoolMemory{ boost::compute::image2d{ context, descs[j].width, descs[j].height, boost::compute::image_format{ descs[j].format }, descs[j].flags } };
+
+                allocated_ += descs[j].size();
+            }
+        }
+
+        peak_ = std::max(peak_, allocated_);
+        ++active_;
+
+        return images;
+    }
+
+    void release(const std::vector<ImageDesc>& descs, std::vector<PoolMemory>& images)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        for (size_t j{ 0 }; j < descs.size(); ++j)
+            free_.emplace_back(descs[j], std::move(images[j]));
+
+        images.clear();
+        --active_;
+        cv_.notify_all();
+    }
+
+    // Drops the idle images when no lease is active, called when a context is freed.
+    void trim()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (active_)
+            return;
+
+        for (const auto& item : free_)
+            allocated_ -= item.first.size();
+
+        free_.clear();
+    }
+
+private:
+    struct RegistryEntry
+    {
+        std::weak_ptr<DevicePool> pool;
+        cl_ulong budget{ 0 };
+    };
+
+    static std::mutex& registry_mtx()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    static std::map<cl_device_id, RegistryEntry>& registry()
+    {
+        static std::map<cl_device_id, RegistryEntry> entries;
+        return entries;
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    cl_ulong budget_;
+    cl_ulong device_mem_;
+    cl_ulong allocated_{ 0 };
+    cl_ulong peak_{ 0 };
+    cl_ulong waits_{ 0 };
+    cl_ulong next_ticket_{ 0 };
+    cl_ulong serving_{ 0 };
+    int active_{ 0 };
+    std::vector<std::pair<ImageDesc, PoolMemory>> free_;
+    boost::compute::device device_;
+    int fission_{ 0 };
+    std::vector<boost::compute::device> devices_;
+    std::vector<int> users_;
+};
+
+struct WorkingSet
+{
+    boost::compute::image2d src;
+    boost::compute::image2d dst;
+    boost::compute::image2d tmp;
+    boost::compute::image2d shift;
+    boost::compute::image2d mask;
+    // Tiles of the interleaved frames, packed formats only.
+    boost::compute::buffer packed_src;
+    boost::compute::buffer packed_dst;
+};
+
+struct ShiftFilter
+{
+    const char* name;
+    int radius;
+    double (*f)(double x);
+};
+
+static constexpr double pi{ 3.14159265358979323846 };
+
+static double sinc(const double x) noexcept
+{
+    return (x == 0.0) ? 1.0 : std::sin(pi * x) / (pi * x);
+}
+
+// The kernels of avsresize that NNEDI3CL_rpow2 offered for the center shift correction. Bicubic is b=1/3, c=1/3 as in avsresize.
+static const ShiftFilter shiftFilters[]
+{
+    { "point", 0, nullptr },
+    { "bilinear", 1, [](double x) { return 1.0 - x; } },
+    { "bicubic", 2, [](double x)
+        {
+            constexpr double b{ 1.0 / 3.0 };
+            constexpr double c{ 1.0 / 3.0 };
+
+            if (x < 1.0)
+                return ((12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x + (6.0 - 2.0 * b)) / 6.0;
+
+            return ((-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x + (-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c)) / 6.0;
+        } },
+    { "lanczos", 3, [](double x) { return sinc(x) * sinc(x / 3.0); } },
+    { "lanczos4", 4, [](double x) { return sinc(x) * sinc(x / 4.0); } },
+    { "spline16", 2, [](double x)
+        {
+            if (x < 1.0)
+                return ((x - 9.0 / 5.0) * x - 1.0 / 5.0) * x + 1.0;
+
+            x -= 1.0;
+            return ((-1.0 / 3.0 * x + 4.0 / 5.0) * x - 7.0 / 15.0) * x;
+        } },
+    { "spline36", 3, [](double x)
+        {
+            if (x < 1.0)
+                return ((13.0 / 11.0 * x - 453.0 / 209.0) * x - 3.0 / 209.0) * x + 1.0;
+            if (x < 2.0)
+            {
+                x -= 1.0;
+                return ((-6.0 / 11.0 * x + 270.0 / 209.0) * x - 156.0 / 209.0) * x;
+            }
+
+            x -= 2.0;
+            return ((1.0 / 11.0 * x - 45.0 / 209.0) * x + 26.0 / 209.0) * x;
+        } },
+    { "spline64", 4, [](double x)
+        {
+            if (x < 1.0)
+                return ((49.0 / 41.0 * x - 6387.0 / 2911.0) * x - 3.0 / 2911.0) * x + 1.0;
+            if (x < 2.0)
+            {
+                x -= 1.0;
+                return ((-24.0 / 41.0 * x + 4032.0 / 2911.0) * x - 2328.0 / 2911.0) * x;
+            }
+            if (x < 3.0)
+            {
+                x -= 2.0;
+                return ((6.0 / 41.0 * x - 1008.0 / 2911.0) * x + 582.0 / 2911.0) * x;
+            }
+
+            x -= 3.0;
+            return ((-1.0 / 41.0 * x + 168.0 / 2911.0) * x - 97.0 / 2911.0) * x;
+        } },
+};
+
+/* Computes the taps that resample a line at x + shift for every x. Sample x + offset + k gets weights[k]. */
+static std::vector<float> shift_weights(const ShiftFilter& filter, const double shift, int& offset)
+{
+    if (shift == 0.0)
+    {
+        offset = 0;
+        return { 1.0f };
+    }
+
+    if (!filter.radius)
+    {
+        offset = static_cast<int>(std::floor(shift + 0.5));
+        return { 1.0f };
+    }
+
+    const int i0{ static_cast<int>(std::floor(shift)) };
+    const double frac{ shift - i0 };
+    std::vector<double> w(2 * filter.radius);
+    double sum{ 0.0 };
+
+    offset = i0 - (filter.radius - 1);
+
+    for (int k{ 0 }; k < 2 * filter.radius; ++k)
+    {
+        w[k] = filter.f(std::abs(k - (filter.radius - 1) - frac));
+        sum += w[k];
+    }
+
+    std::vector<float> weights(w.size());
+    for (size_t k{ 0 }; k < w.size(); ++k)
+        weights[k] = static_cast<float>(w[k] / sum);
+
+    return weights;
+}
+
+struct NNEDI3CL_Context
+{
+    int dh;
+    int dw;
+    int bytes_per_sample;
+    bool st;
+    // 0: the whole plane is processed at once. Otherwise the size of the (square) tiles in source pixels.
+    int tile;
+    int halo;
+    // Tiles alternate between the two queues/working sets so the transfers of one tile overlap the kernels of the other.
+    // queue[1] and ws[1] are used only in tiled mode.
+    boost::compute::command_queue queue[2];
+    WorkingSet ws[2];
+    // The working-set images are leased from the pool between the first submit and the next wait.
+    std::shared_ptr<DevicePool> pool;
+    // The (sub-)device the queues run on.
+    boost::compute::device device;
+    std::vector<ImageDesc> ws_desc;
+    // The descriptors of the current lease: ws_desc, or ws_desc without the source and destination images for untiled cl_mem planes.
+    std::vector<ImageDesc> leased_desc;
+    std::vector<PoolMemory> leased;
+    cl_ulong reserved{ 0 };
+    boost::compute::kernel kernel;
+    // 0: planar frames, otherwise NNEDI3CL_PACKED_*. packed_step is the number of samples per pixel (2 for YUY2).
+    int packed;
+    int packed_step;
+    boost::compute::kernel unpack_kernel;
+    boost::compute::kernel pack_kernel;
+    // 0: no mask, 1: outside the mask the original lines are kept, 2: outside the mask the lines are interpolated.
+    int mask;
+    // Center shift correction. Index [0: full-width planes, 1: narrower planes][0: horizontal, 1: vertical].
+    int width;
+    int height;
+    bool cshift{ false };
+    double shift[2][2];
+    boost::compute::kernel shift_kernel[2];
+    boost::compute::buffer shift_weights[2][2];
+    int shift_taps[2][2];
+    int shift_offset[2][2];
+    boost::compute::buffer weights0;
+    boost::compute::buffer weights1Buffer;
+    cl_mem weights1{ nullptr };
+    std::string err;
+
+    ~NNEDI3CL_Context()
+    {
+        if (weights1)
+            clReleaseMemObject(weights1);
+
+        // Nothing can be reported from here, so a device error only skips the draining and the lease is returned regardless.
+        if (pool)
+        {
+            try
+            {
+                if (!leased.empty())
+                {
+                    try
+                    {
+                        queue[0].finish();
+                        if (tile)
+                            queue[1].finish();
+                    }
+                    catch (...)
+                    {
+                    }
+
+                    pool->release(leased_desc, leased);
+                }
+
+                pool->unreserve(reserved);
+                pool->trim();
+
+                if (device.id())
+                    pool->close(device);
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+};
+
+static inline int roundds(const double f) noexcept
+{
+    return (f - std::floor(f) >= 0.5) ? std::min(static_cast<int>(std::ceil(f)), 32767) : std::max(static_cast<int>(std::floor(f)), -32768);
+}
+
+static void copy_string(char* buf, const size_t size, const std::string& str) noexcept
+{
+    if (!buf || !size)
+        return;
+
+    const size_t len{ std::min(str.size(), size - 1) };
+    memcpy(buf, str.c_str(), len);
+    buf[len] = '\0';
+}
+
+// The message of the exception being handled. No exception leaves the C API, every entry point maps them through here.
+static std::string current_error()
+{
+    try
+    {
+        throw;
+    }
+    catch (const std::string& error)
+    {
+        return error;
+    }
+    catch (const boost::compute::opencl_error& error)
+    {
+        return error.error_string();
+    }
+    catch (const std::exception& error)
+    {
+        return error.what();
+    }
+    catch (...)
+    {
+        return "unknown error";
+    }
+}
+
+template<typename F>
+static int guarded(NNEDI3CL_Context* d, F&& f)
+{
+    try
+    {
+        f();
+        return 0;
+    }
+    catch (...)
+    {
+        d->err = current_error();
+    }
+
+    return -1;
+}
+
+// guarded() for the functions without a context. The error message is copied to buf.
+template<typename F>
+static int guarded_err(char* buf, const size_t size, F&& f)
+{
+    try
+    {
+        f();
+        return 0;
+    }
+    catch (...)
+    {
+        copy_string(buf, size, current_error());
+    }
+
+    return -1;
+}
+
+#ifndef CL_DEVICE_INTEGER_DOT_PRODUCT_CAPABILITIES_KHR
+#define CL_DEVICE_INTEGER_DOT_PRODUCT_CAPABILITIES_KHR 0x1073
+#endif
+#ifndef CL_DEVICE_INTEGER_DOT_PRODUCT_INPUT_4x8BIT_KHR
+#define CL_DEVICE_INTEGER_DOT_PRODUCT_INPUT_4x8BIT_KHR (1 << 1)
+#endif
+
+// Whether the device has the dot(uchar4, char4) form of cl_khr_integer_dot_product. Only the packed form is mandatory.
+static bool has_int_dot(const boost::compute::device& device)
+{
+    return device.supports_extension("cl_khr_integer_dot_product") &&
+        (device.get_info<cl_bitfield>(CL_DEVICE_INTEGER_DOT_PRODUCT_CAPABILITIES_KHR) & CL_DEVICE_INTEGER_DOT_PRODUCT_INPUT_4x8BIT_KHR);
+}
+
+static boost::compute::device get_device(const int device_id)
+{
+    if (device_id >= static_cast<int>(boost::compute::system::device_count()))
+        throw std::string{ "device index out of range" };
+
+    if (device_id > -1)
+        return boost::compute::system::devices().at(device_id);
+
+    return boost::compute::system::default_device();
+}
+
+static void enqueue_plane(NNEDI3CL_Context* d, boost::compute::command_queue& queue, WorkingSet& ws, const int src_width, const int src_height, const int field_n,
+    const int shift_set)
+{
+    auto& src_image{ ws.src };
+    auto& dst_image{ ws.dst };
+    auto& tmp_image{ ws.tmp };
+    auto& shift_image{ ws.shift };
+
+    const int dst_width{ src_width << d->dw };
+    const int dst_height{ src_height << d->dh };
+
+    if (static_cast<size_t>(src_width) > src_image.width() || static_cast<size_t>(src_height) > src_image.height())
+        throw std::string{ "source plane is larger than the source image" };
+    if (static_cast<size_t>(dst_width) > dst_image.width() || static_cast<size_t>(dst_height) > dst_image.height())
+        throw std::string{ "destination plane is larger than the destination image" };
+
+    auto kernel{ d->kernel };
+
+    constexpr size_t localWorkSize[2]{ 4, 16 };
+
+    if (d->dh && d->dw)
+    {
+        size_t globalWorkSize[]{ static_cast<size_t>(((src_height + 7) / 8 + 3) & -4), static_cast<size_t>((dst_width / 2 + 15) & -16) };
+        kernel.set_args(src_image, tmp_image, d->weights0, d->weights1, src_height, src_width, src_height, dst_width, field_n, 1 - field_n, -1);
+        queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
+
+        globalWorkSize[0] = static_cast<size_t>(((dst_width + 7) / 8 + 3) & -4);
+        globalWorkSize[1] = static_cast<size_t>((dst_height / 2 + 15) & -16);
+        kernel.set_args(tmp_image, dst_image, d->weights0, d->weights1, dst_width, src_height, dst_width, dst_height, field_n, 1 - field_n, 0);
+        queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
+    }
+    else if (d->dw)
+    {
+        const size_t globalWorkSize[]{ static_cast<size_t>(((dst_height + 7) / 8 + 3) & -4), static_cast<size_t>((dst_width / 2 + 15) & -16) };
+        kernel.set_args(src_image, dst_image, d->weights0, d->weights1, src_height, src_width, dst_height, dst_width, field_n, 1 - field_n, -1);
+        queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
+    }
+    else
+    {
+        const size_t globalWorkSize[]{ static_cast<size_t>(((dst_width + 7) / 8 + 3) & -4), static_cast<size_t>((dst_height / 2 + 15) & -16) };
+        kernel.set_args(src_image, dst_image, d->weights0, d->weights1, src_width, src_height, dst_width, dst_height, field_n, 1 - field_n, 0);
+        if (d->mask)
+            kernel.set_arg(11, ws.mask);
+        queue.enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
+    }
+
+    // Resample the result in place: dst -> shift horizontally, shift -> dst vertically.
+    if (d->cshift && (d->shift[shift_set][0] != 0.0 || d->shift[shift_set][1] != 0.0))
+    {
+        const size_t globalWorkSize[]{ static_cast<size_t>(dst_width), static_cast<size_t>(dst_height) };
+
+        for (int i{ 0 }; i < 2; ++i)
+        {
+            auto shift_kernel{ d->shift_kernel[i] };
+
+            if (i == 0)
+                shift_kernel.set_args(dst_image, shift_image, d->shift_weights[shift_set][i], d->shift_taps[shift_set][i], d->shift_offset[shift_set][i], dst_width, dst_height);
+            else
+                shift_kernel.set_args(shift_image, dst_image, d->shift_weights[shift_set][i], d->shift_taps[shift_set][i], d->shift_offset[shift_set][i], dst_width, dst_height);
+
+            queue.enqueue_nd_range_kernel(shift_kernel, 2, nullptr, globalWorkSize, nullptr);
+        }
+    }
+}
+
+/* Leases the working set. planes = false leaves out the source and destination images, which the untiled cl_mem planes
+   are processed in directly (only valid without tile, mask and packed). */
+static void lease(NNEDI3CL_Context* d, const bool planes = true)
+{
+    if (!d->leased.empty())
+    {
+        if (planes && d->leased_desc.size() != d->ws_desc.size())
+            throw std::string{ "nnedi3cl_wait must be called between nnedi3cl_process_plane_mem and the functions taking host pointers" };
+
+        return;
+    }
+
+    d->leased_desc = (planes) ? d->ws_desc : std::vector<ImageDesc>(d->ws_desc.begin() + 2, d->ws_desc.end());
+
+    // Nothing to lease (no dh + dw pair and no cshift), which also keeps the pool from counting a lease that is never returned.
+    if (d->leased_desc.empty())
+        return;
+
+    d->leased = d->pool->acquire(d->leased_desc);
+
+    size_t j{ 0 };
+    auto image = [&]() { return boost::compute::image2d{ d->leased[j++].get() }; };
+    auto buffer = [&]() { return boost::compute::buffer{ d->leased[j++].get() }; };
+
+    for (int i{ 0 }; i < ((d->tile) ? 2 : 1); ++i)
+    {
+        d->ws[i].src = (planes) ? image() : boost::compute::image2d{};
+        d->ws[i].dst = (planes) ? image() : boost::compute::image2d{};
+        d->ws[i].tmp = (d->dh && d->dw) ? image() : boost::compute::image2d{};
+        d->ws[i].shift = (d->cshift) ? image() : boost::compute::image2d{};
+        d->ws[i].mask = (d->mask) ? image() : boost::compute::image2d{};
+        d->ws[i].packed_src = (d->packed) ? buffer() : boost::compute::buffer{};
+        d->ws[i].packed_dst = (d->packed) ? buffer() : boost::compute::buffer{};
+    }
+}
+
+/* Runs the plane through the working sets tile by tile.
+   upload(queue, ws, x, y, width, height) must copy that source rectangle to the origin of ws.src (ws.packed_src for packed frames).
+   process(queue, ws, width, height, x, y, out_width, out_height) runs the uploaded width x height source through ws,
+   (x, y, out_width, out_height) is the rectangle of ws.dst that is downloaded afterwards.
+   download(queue, ws, x, y, dst_x, dst_y, width, height) must copy that rectangle of ws.dst to (dst_x, dst_y) of the destination.
+   Tiles overlap by d->halo source pixels, which is larger than the area the kernel reads around each pixel,
+   so only the mirrored borders of the inner tiles differ from processing the whole plane and those are discarded.
+   Tile origins are multiples of 8 (16 for YUY2, whose chroma is tiled at half the coordinates) which keeps the 8-pixel prescreener groups identical too. */
+template<typename U, typename P, typename D>
+static void process_tiles(NNEDI3CL_Context* d, const int src_width, const int src_height, U&& upload, P&& process, D&& download)
+{
+    const int tile{ (d->tile) ? d->tile : std::max(src_width, src_height) };
+    int n{ 0 };
+
+    for (int y0{ 0 }; y0 < src_height; y0 += tile)
+    {
+        for (int x0{ 0 }; x0 < src_width; x0 += tile, ++n)
+        {
+            auto& queue{ d->queue[n & !!d->tile] };
+            auto& ws{ d->ws[n & !!d->tile] };
+
+            const int x1{ std::min(x0 + tile, src_width) };
+            const int y1{ std::min(y0 + tile, src_height) };
+            const int sx0{ std::max(x0 - d->halo, 0) };
+            const int sy0{ std::max(y0 - d->halo, 0) };
+            const int sx1{ std::min(x1 + d->halo, src_width) };
+            const int sy1{ std::min(y1 + d->halo, src_height) };
+
+            upload(queue, ws, sx0, sy0, sx1 - sx0, sy1 - sy0);
+            process(queue, ws, sx1 - sx0, sy1 - sy0, (x0 - sx0) << d->dw, (y0 - sy0) << d->dh, (x1 - x0) << d->dw, (y1 - y0) << d->dh);
+            download(queue, ws, (x0 - sx0) << d->dw, (y0 - sy0) << d->dh, x0 << d->dw, y0 << d->dh, (x1 - x0) << d->dw, (y1 - y0) << d->dh);
+        }
+    }
+}
+
+// Waits for both queues and returns the lease even when waiting fails, so other contexts on the device never wait for it forever.
+// The first error is rethrown afterwards.
+static void finish(NNEDI3CL_Context* d)
+{
+    std::exception_ptr error;
+
+    for (int i{ 0 }; i < ((d->tile) ? 2 : 1); ++i)
+    {
+        try
+        {
+            d->queue[i].finish();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    if (!d->leased.empty())
+    {
+        for (auto& ws : d->ws)
+            ws = WorkingSet{};
+
+        d->pool->release(d->leased_desc, d->leased);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// finish(), serialized with the other instances when st is set.
+static void drain(NNEDI3CL_Context* d)
+{
+    if (d->st)
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        finish(d);
+    }
+    else
+        finish(d);
+}
+
+/* Leases the working set and runs the tiles. The blocking functions wait for the work. When enqueuing fails partway they still drain
+   the transfers already enqueued, which reference the caller's pointers, and return the lease before the error is reported. */
+template<typename U, typename P, typename D>
+static void submit_tiles(NNEDI3CL_Context* d, const int width, const int height, U&& upload, P&& process, D&& download, const bool blocking)
+{
+    lease(d);
+
+    try
+    {
+        process_tiles(d, width, height, upload, process, download);
+    }
+    catch (...)
+    {
+        if (blocking)
+        {
+            try
+            {
+                drain(d);
+            }
+            catch (...)
+            {
+            }
+        }
+
+        throw;
+    }
+
+    if (blocking)
+        drain(d);
+}
+
+static void submit_plane(NNEDI3CL_Context* d, const void* srcp, const ptrdiff_t src_pitch, const void* maskp, const ptrdiff_t mask_pitch, const int src_width,
+    const int src_height, void* dstp, const ptrdiff_t dst_pitch, const int field_n, const int shift_set, const bool blocking)
+{
+    if (src_pitch < 0 || dst_pitch < 0 || mask_pitch < 0)
+        throw std::string{ "negative pitch is not supported" };
+    if (d->packed)
+        throw std::string{ "the context was created for packed frames, use the packed functions" };
+    if (d->mask && !maskp)
+        throw std::string{ "the context was created with a mask, use the masked functions" };
+    if (!d->mask && maskp)
+        throw std::string{ "the context was created without a mask" };
+    if (shift_set < 0 || shift_set > 1)
+        throw std::string{ "shift_set must be 0 or 1" };
+
+    // The queues are in-order, so the transfers don't need to block even when the same images are reused by the next tile or plane.
+    auto upload = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int x, const int y, const int width, const int height)
+    {
+        const size_t origin[3]{ 0, 0, 0 };
+        const size_t region[3]{ static_cast<size_t>(width), static_cast<size_t>(height), 1 };
+        const uint8_t* p{ reinterpret_cast<const uint8_t*>(srcp) + y * src_pitch + x * d->bytes_per_sample };
+
+        if (region[0] > ws.src.width() || region[1] > ws.src.height())
+            throw std::string{ "source plane is larger than the source image" };
+
+        cl_int error{ clEnqueueWriteImage(queue.get(), ws.src.get(), CL_FALSE, origin, region, src_pitch, 0, p, 0, nullptr, nullptr) };
+        if (error != CL_SUCCESS)
+            BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+
+        if (d->mask)
+        {
+            const uint8_t* m{ reinterpret_cast<const uint8_t*>(maskp) + y * mask_pitch + x * d->bytes_per_sample };
+
+            error = clEnqueueWriteImage(queue.get(), ws.mask.get(), CL_FALSE, origin, region, mask_pitch, 0, m, 0, nullptr, nullptr);
+            if (error != CL_SUCCESS)
+                BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+        }
+    };
+
+    auto download = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int x, const int y, const int dst_x, const int dst_y, const int width,
+        const int height)
+    {
+        const size_t origin[3]{ static_cast<size_t>(x), static_cast<size_t>(y), 0 };
+        const size_t region[3]{ static_cast<size_t>(width), static_cast<size_t>(height), 1 };
+        uint8_t* p{ reinterpret_cast<uint8_t*>(dstp) + dst_y * dst_pitch + dst_x * d->bytes_per_sample };
+
+        const cl_int error{ clEnqueueReadImage(queue.get(), ws.dst.get(), CL_FALSE, origin, region, dst_pitch, 0, p, 0, nullptr, nullptr) };
+        if (error != CL_SUCCESS)
+            BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+    };
+
+    auto process = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int width, const int height, int, int, int, int)
+    {
+        enqueue_plane(d, queue, ws, width, height, field_n, shift_set);
+    };
+
+    submit_tiles(d, src_width, src_height, upload, process, download, blocking);
+}
+
+/* Uploads each tile of the interleaved frame once, splits it into the components on the device, runs each component through the working set
+   and interleaves the results, which are downloaded once per tile.
+   A negative pitch means the rows are stored bottom-up (p points to the top row). */
+static void submit_packed(NNEDI3CL_Context* d, const void* srcp, ptrdiff_t src_pitch, const int width, const int height, void* dstp, ptrdiff_t dst_pitch,
+    const int field_n, const bool blocking)
+{
+    if (!d->packed)
+        throw std::string{ "the context was created for planar frames" };
+    if (width > d->width || height > d->height)
+        throw std::string{ "frame is larger than the frame size of the context" };
+    if (d->packed == NNEDI3CL_PACKED_YUY2 && (width & 1))
+        throw std::string{ "YUY2 width must be mod 2" };
+
+    const int dst_height{ height << d->dh };
+    const int src_flip{ src_pitch < 0 };
+    const int dst_flip{ dst_pitch < 0 };
+
+    // Upload/download from the lowest address, the kernels restore the row order within the tile.
+    if (src_flip)
+    {
+        srcp = reinterpret_cast<const uint8_t*>(srcp) + (height - 1) * src_pitch;
+        src_pitch = -src_pitch;
+    }
+
+    if (dst_flip)
+    {
+        dstp = reinterpret_cast<uint8_t*>(dstp) + (dst_height - 1) * dst_pitch;
+        dst_pitch = -dst_pitch;
+    }
+
+    const int yuy2{ d->packed == NNEDI3CL_PACKED_YUY2 };
+    const int num_components{ (d->packed == NNEDI3CL_PACKED_BGRA) ? 4 : 3 };
+    const size_t pixel_size{ static_cast<size_t>(d->packed_step) * d->bytes_per_sample };
+
+    // The tile is stored at the origin of ws.packed_src with no padding between the rows.
+    auto upload = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int x, const int y, const int tile_width, const int tile_height)
+    {
+        const size_t buffer_origin[3]{ 0, 0, 0 };
+        const size_t host_origin[3]{ x * pixel_size, static_cast<size_t>((src_flip) ? height - y - tile_height : y), 0 };
+        const size_t region[3]{ tile_width * pixel_size, static_cast<size_t>(tile_height), 1 };
+
+        if (region[0] * region[1] > ws.packed_src.size())
+            throw std::string{ "source tile is larger than the source buffer" };
+
+        const cl_int error{ clEnqueueWriteBufferRect(queue.get(), ws.packed_src.get(), CL_FALSE, buffer_origin, host_origin, region, region[0], 0, src_pitch, 0,
+            srcp, 0, nullptr, nullptr) };
+        if (error != CL_SUCCESS)
+            BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+    };
+
+    // Only the output rectangle is interleaved, to the origin of ws.packed_dst with no padding between the rows.
+    auto process = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int tile_width, const int tile_height, const int x, const int y,
+        const int out_width, const int out_height)
+    {
+        for (int c{ 0 }; c < num_components; ++c)
+        {
+            // YUY2 is Y0 U Y1 V, so the chroma components have every 4th sample and half the width.
+            const int step{ (yuy2 && c) ? 4 : d->packed_step };
+            const int offset{ (yuy2 && c == 2) ? 3 : c };
+            const int log2_ratio{ yuy2 && c };
+            const int plane_width{ tile_width >> log2_ratio };
+
+            auto unpack_kernel{ d->unpack_kernel };
+            const size_t unpackWorkSize[]{ static_cast<size_t>(plane_width), static_cast<size_t>(tile_height) };
+            unpack_kernel.set_args(ws.packed_src, tile_width * d->packed_step, ws.src, step, offset, plane_width, tile_height, src_flip);
+            queue.enqueue_nd_range_kernel(unpack_kernel, 2, nullptr, unpackWorkSize, nullptr);
+
+            enqueue_plane(d, queue, ws, plane_width, tile_height, field_n, yuy2 && c);
+
+            auto pack_kernel{ d->pack_kernel };
+            const size_t packWorkSize[]{ static_cast<size_t>(out_width >> log2_ratio), static_cast<size_t>(out_height) };
+            pack_kernel.set_args(ws.dst, ws.packed_dst, out_width * d->packed_step, step, offset, x >> log2_ratio, y, out_width >> log2_ratio, out_height,
+                dst_flip);
+            queue.enqueue_nd_range_kernel(pack_kernel, 2, nullptr, packWorkSize, nullptr);
+        }
+    };
+
+    auto download = [&](boost::compute::command_queue& queue, WorkingSet& ws, int, int, const int dst_x, const int dst_y, const int out_width,
+        const int out_height)
+    {
+        const size_t buffer_origin[3]{ 0, 0, 0 };
+        const size_t host_origin[3]{ dst_x * pixel_size, static_cast<size_t>((dst_flip) ? dst_height - dst_y - out_height : dst_y), 0 };
+        const size_t region[3]{ out_width * pixel_size, static_cast<size_t>(out_height), 1 };
+
+        const cl_int error{ clEnqueueReadBufferRect(queue.get(), ws.packed_dst.get(), CL_FALSE, buffer_origin, host_origin, region, region[0], 0, dst_pitch, 0,
+            dstp, 0, nullptr, nullptr) };
+        if (error != CL_SUCCESS)
+            BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+    };
+
+    submit_tiles(d, width, height, upload, process, download, blocking);
+}
+
+void nnedi3cl_default_params(NNEDI3CL_Params* params)
+{
+    params->width = 0;
+    params->height = 0;
+    params->bits_per_sample = 8;
+    params->dh = 0;
+    params->dw = 0;
+    params->nsize = 6;
+    params->nns = 1;
+    params->qual = 1;
+    params->etype = 0;
+    params->pscrn = -1;
+    params->pquant = 0;
+    params->device = -1;
+    params->st = -1;
+    params->tile = 0;
+    params->fission = 0;
+    params->packed = 0;
+    params->mask = 0;
+    params->cshift = nullptr;
+
+    for (int i{ 0 }; i < 2; ++i)
+    {
+        params->shift_x[i] = 0.0;
+        params->shift_y[i] = 0.0;
+    }
+
+    params->weights_path = nullptr;
+}
+
+int nnedi3cl_device_count(void)
+{
+    try
+    {
+        return static_cast<int>(boost::compute::system::device_count());
+    }
+    catch (...)
+    {
+        return 0;
+    }
+}
+
+int nnedi3cl_list_devices(char* buf, size_t size)
+{
+    return guarded_err(buf, size, [&]()
+        {
+            std::string text;
+
+            const auto devices{ boost::compute::system::devices() };
+
+            for (size_t i{ 0 }; i < devices.size(); ++i)
+                text += std::to_string(i) + ": " + devices[i].name() + " (" + devices[i].platform().name() + ")" + "\n";
+
+            copy_string(buf, size, text);
+        });
+}
+
+int nnedi3cl_device_info(int device_id, char* buf, size_t size)
+{
+    return guarded_err(buf, size, [&]()
+        {
+            std::string text;
+
+            const boost::compute::device device{ get_device(device_id) };
+
+            text = "=== Platform Info ===\n";
+            const auto platform{ device.platform() };
+            text += "Profile: " + platform.get_info<CL_PLATFORM_PROFILE>() + "\n";
+            text += "Version: " + platform.get_info<CL_PLATFORM_VERSION>() + "\n";
+            text += "Name: " + platform.get_info<CL_PLATFORM_NAME>() + "\n";
+            text += "Vendor: " + platform.get_info<CL_PLATFORM_VENDOR>() + "\n";
+
+            text += "\n";
+
+            text += "=== Device Info ===\n";
+            text += "Name: " + device.get_info<CL_DEVICE_NAME>() + "\n";
+            text += "Vendor: " + device.get_info<CL_DEVICE_VENDOR>() + "\n";
+            text += "Profile: " + device.get_info<CL_DEVICE_PROFILE>() + "\n";
+            text += "Version: " + device.get_info<CL_DEVICE_VERSION>() + "\n";
+            text += "Max compute units: " + std::to_string(device.get_info<CL_DEVICE_MAX_COMPUTE_UNITS>()) + "\n";
+            text += "Max work-group size: " + std::to_string(device.get_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>()) + "\n";
+            const auto max_work_item_sizes{ device.get_info<CL_DEVICE_MAX_WORK_ITEM_SIZES>() };
+            text += "Max work-item sizes: " + std::to_string(max_work_item_sizes[0]) + ", " + std::to_string(max_work_item_sizes[1]) + ", " + std::to_string(max_work_item_sizes[2]) + "\n";
+            text += "2D image max width: " + std::to_string(device.get_info<CL_DEVICE_IMAGE2D_MAX_WIDTH>()) + "\n";
+            text += "2D image max height: " + std::to_string(device.get_info<CL_DEVICE_IMAGE2D_MAX_HEIGHT>()) + "\n";
+            text += "Image support: " + std::string{ device.get_info<CL_DEVICE_IMAGE_SUPPORT>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            const auto global_mem_cache_type{ device.get_info<CL_DEVICE_GLOBAL_MEM_CACHE_TYPE>() };
+            if (global_mem_cache_type == CL_NONE)
+                text += "Global memory cache type: CL_NONE\n";
+            else if (global_mem_cache_type == CL_READ_ONLY_CACHE)
+                text += "Global memory cache type: CL_READ_ONLY_CACHE\n";
+            else if (global_mem_cache_type == CL_READ_WRITE_CACHE)
+                text += "Global memory cache type: CL_READ_WRITE_CACHE\n";
+            text += "Global memory cache size: " + std::to_string(device.get_info<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE>() / 1024) + " KB\n";
+            text += "Global memory size: " + std::to_string(device.get_info<CL_DEVICE_GLOBAL_MEM_SIZE>() / (1024 * 1024)) + " MB\n";
+            text += "Max constant buffer size: " + std::to_string(device.get_info<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>() / 1024) + " KB\n";
+            text += "Max constant arguments: " + std::to_string(device.get_info<CL_DEVICE_MAX_CONSTANT_ARGS>()) + "\n";
+            text += "Local memory type: " + std::string{ device.get_info<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL ? "CL_LOCAL" : "CL_GLOBAL" } + "\n";
+            text += "Local memory size: " + std::to_string(device.get_info<CL_DEVICE_LOCAL_MEM_SIZE>() / 1024) + " KB\n";
+            text += "Available: " + std::string{ device.get_info<CL_DEVICE_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            text += "Compiler available: " + std::string{ device.get_info<CL_DEVICE_COMPILER_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            text += "OpenCL C version: " + device.get_info<CL_DEVICE_OPENCL_C_VERSION>() + "\n";
+            text += "Linker available: " + std::string{ device.get_info<CL_DEVICE_LINKER_AVAILABLE>() ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            text += "Integer dot product: " + std::string{ has_int_dot(device) ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            text += "Image max buffer size: " + std::to_string(device.get_info<size_t>(CL_DEVICE_IMAGE_MAX_BUFFER_SIZE) / 1024) + " KB" + "\n";
+            text += "Out of order (on host): " + std::string{ !!(device.get_info<CL_DEVICE_QUEUE_ON_HOST_PROPERTIES>() & 1) ? "CL_TRUE" : "CL_FALSE" } + "\n";
+            text += "Out of order (on device): " + std::string{ !!(device.get_info<CL_DEVICE_QUEUE_ON_DEVICE_PROPERTIES>() & 1) ? "CL_TRUE" : "CL_FALSE" } + "\n";
+
+            text += "Max sub-devices: " + std::to_string(device.get_info<cl_uint>(CL_DEVICE_PARTITION_MAX_SUB_DEVICES)) + "\n";
+
+            NNEDI3CL_MemoryStats stats;
+            const auto pool{ DevicePool::get(device) };
+            pool->stats(&stats);
+            const auto partitions{ pool->partitions() };
+
+            if (!partitions.empty())
+            {
+                text += "\n";
+
+                text += "=== NNEDI3CL Sub-devices ===\n";
+                for (size_t i{ 0 }; i < partitions.size(); ++i)
+                    text += std::to_string(i) + ": " + std::to_string(partitions[i].first) + " compute units, " + std::to_string(partitions[i].second) + " instances\n";
+            }
+
+            text += "\n";
+
+            text += "=== NNEDI3CL Memory ===\n";
+            text += "Budget: " + std::to_string(stats.budget / (1024 * 1024)) + " MB\n";
+            text += "Allocated: " + std::to_string(stats.allocated / (1024 * 1024)) + " MB\n";
+            text += "Peak: " + std::to_string(stats.peak / (1024 * 1024)) + " MB\n";
+            text += "Waits for memory: " + std::to_string(stats.waits);
+
+            copy_string(buf, size, text);
+        });
+}
+
+int nnedi3cl_set_memory_budget(int device_id, unsigned long long bytes, char* err, size_t err_size)
+{
+    return guarded_err(err, err_size, [&]() { DevicePool::set_budget(get_device(device_id), bytes); });
+}
+
+int nnedi3cl_get_memory_stats(int device_id, NNEDI3CL_MemoryStats* stats)
+{
+    try
+    {
+        DevicePool::get(get_device(device_id))->stats(stats);
+        return 0;
+    }
+    catch (...)
+    {
+    }
+
+    return -1;
+}
+
+static NNEDI3CL_Context* create(const NNEDI3CL_Params* params)
+{
+    std::unique_ptr<NNEDI3CL_Context> d{ std::make_unique<NNEDI3CL_Context>() };
+
+    const int bits{ params->bits_per_sample };
+    const bool is_float{ bits == 32 };
+    const int nsize{ params->nsize };
+    const int nns{ params->nns };
+    const int qual{ params->qual };
+    const int etype{ params->etype };
+    const int pscrn{ (params->pscrn > -1) ? params->pscrn : (is_float) ? 1 : 2 };
+    const int pquant{ params->pquant };
+
+    d->dh = !!params->dh;
+    d->dw = !!params->dw;
+
+    if (!is_float && (bits < 8 || bits > 16))
+        throw std::string{ "bits_per_sample must be 8..16 or 32" };
+    if (params->width < 1 || params->height < 1)
+        throw std::string{ "width and height must be positive" };
+    if (nsize < 0 || nsize > 6)
+        throw std::string{ "nsize must be 0, 1, 2, 3, 4, 5 or 6" };
+    if (nns < 0 || nns > 4)
+        throw std::string{ "nns must be 0, 1, 2, 3 or 4" };
+    if (qual < 1 || qual > 2)
+        throw std::string{ "qual must be 1 or 2" };
+    if (etype < 0 || etype > 1)
+        throw std::string{ "etype must be 0 or 1" };
+
+    if (pquant < 0 || pquant > 2)
+        throw std::string{ "pquant must be 0, 1 or 2" };
+    if (pquant && bits != 8)
+        throw std::string{ "pquant is supported only for 8-bit input" };
+
+    if (params->mask < 0 || params->mask > 2)
+        throw std::string{ "mask must be 0, 1 or 2" };
+    if (params->mask && (d->dh || d->dw))
+        throw std::string{ "mask requires dh=false and dw=false" };
+
+    d->mask = params->mask;
+
+    if (params->packed < 0 || params->packed > NNEDI3CL_PACKED_BGRA)
+        throw std::string{ "packed must be 0, NNEDI3CL_PACKED_YUY2, NNEDI3CL_PACKED_BGR or NNEDI3CL_PACKED_BGRA" };
+    if (params->packed == NNEDI3CL_PACKED_YUY2 && bits != 8)
+        throw std::string{ "YUY2 must be 8-bit" };
+    if (params->packed && bits != 8 && bits != 16)
+        throw std::string{ "packed frames must be 8 or 16-bit" };
+    if (params->packed && d->mask)
+        throw std::string{ "mask is not supported for packed frames" };
+
+    d->packed = params->packed;
+    d->packed_step = (d->packed == NNEDI3CL_PACKED_YUY2) ? 2 : (d->packed == NNEDI3CL_PACKED_BGR) ? 3 : (d->packed == NNEDI3CL_PACKED_BGRA) ? 4 : 0;
+
+    if (!is_float)
+    {
+        if (pscrn < 1 || pscrn > 2)
+            throw std::string{ "pscrn must be 1 or 2" };
+    }
+    else
+    {
+        if (pscrn != 1)
+            throw std::string{ "pscrn must be 1 for float input" };
+    }
+
+    if (params->fission < -1)
+        throw std::string{ "fission must be -1, 0 or the number of compute units per sub-device" };
+
+    d->pool = DevicePool::get(get_device(params->device));
+    d->device = d->pool->open(params->fission);
+    const boost::compute::device device{ d->device };
+    boost::compute::context context{ d->pool->context };
+    d->queue[0] = boost::compute::command_queue{ context, device };
+
+    const int peak{ (is_float) ? 1 : (1 << bits) - 1 };
+
+    std::string weightsPath{ (params->weights_path) ? params->weights_path : boost::dll::this_line_location().parent_path().generic_string() + "/nnedi3_weights.bin" };
+
+    FILE* weightsFile{ nullptr };
+#ifdef _WIN32
+    const int requiredSize{ MultiByteToWideChar(CP_UTF8, 0, weightsPath.c_str(), -1, nullptr, 0) };
+    std::unique_ptr<wchar_t[]> wbuffer{ std::make_unique<wchar_t[]>(requiredSize) };
+    MultiByteToWideChar(CP_UTF8, 0, weightsPath.c_str(), -1, wbuffer.get(), requiredSize);
+    weightsFile = _wfopen(wbuffer.get(), L"rb");
+#else
+    weightsFile = std::fopen(weightsPath.c_str(), "rb");
+#endif
+
+#if !defined(_WIN32) && defined(NNEDI3_DATADIR)
+    if (!weightsFile && !params->weights_path)
+    {
+        weightsPath = std::string{ NNEDI3_DATADIR } + "/nnedi3_weights.bin";
+        weightsFile = std::fopen(weightsPath.c_str(), "rb");
+    }
+#endif
+    if (!weightsFile)
+        throw std::string{ "error opening file " + weightsPath + " (" + std::strerror(errno) + ")" };
+
+    if (std::fseek(weightsFile, 0, SEEK_END))
+    {
+        std::fclose(weightsFile);
+        throw std::string{ "error seeking to the end of file " + weightsPath + " (" + std::strerror(errno) + ")" };
+    }
+
+    constexpr long correctSize{ 13574928 }; // Version 0.9.4 of the Avisynth plugin
+    const long weightsSize{ std::ftell(weightsFile) };
+
+    if (weightsSize == -1)
+    {
+        std::fclose(weightsFile);
+        throw std::string{ "error determining the size of file " + weightsPath + " (" + std::strerror(errno) + ")" };
+    }
+    else if (weightsSize != correctSize)
+    {
+        std::fclose(weightsFile);
+        throw std::string{ "incorrect size of file " + weightsPath + ". Should be " + std::to_string(correctSize) + " bytes, but got " + std::to_string(weightsSize) + " bytes instead" };
+    }
+
+    std::rewind(weightsFile);
+
+    std::vector<float> bdata(correctSize / sizeof(float));
+    const size_t bytesRead{ std::fread(bdata.data(), 1, correctSize, weightsFile) };
+
+    if (bytesRead != correctSize)
+    {
+        std::fclose(weightsFile);
+        throw std::string{ "error reading file " + weightsPath + ". Should read " + std::to_string(correctSize) + " bytes, but read " + std::to_string(bytesRead) + " bytes instead" };
+    }
+
+    std::fclose(weightsFile);
+
+    constexpr int dims0{ 49 * 4 + 5 * 4 + 9 * 4 };
+    constexpr int dims0new{ 4 * 65 + 4 * 5 };
+    const int dims1{ nnsTable[nns] * 2 * (xdiaTable[nsize] * ydiaTable[nsize] + 1) };
+    int dims1tsize{ 0 };
+    int dims1offset{ 0 };
+
+    for (int j{ 0 }; j < numNNS; ++j)
+    {
+        for (int i{ 0 }; i < numNSIZE; ++i)
+        {
+            if (i == nsize && j == nns)
+                dims1offset = dims1tsize;
+
+            dims1tsize += nnsTable[j] * 2 * (xdiaTable[i] * ydiaTable[i] + 1) * 2;
+        }
+    }
+
+    std::vector<float> weights0(std::max(dims0, dims0new));
+    std::vector<float> weights1(dims1 * 2);
+
+    // Adjust prescreener weights
+    if (pscrn == 2) // using new prescreener
+    {
+        std::vector<int> offt(4 * 64);
+
+        for (int j{ 0 }; j < 4; ++j)
+        {
+            for (int k{ 0 }; k < 64; ++k)
+                offt[j * 64 + k] = ((k >> 3) << 5) + ((j & 3) << 3) + (k & 7);
+        }
+
+        const float* bdw{ bdata.data() + dims0 + dims0new * (pscrn - 2) };
+        short* ws{ reinterpret_cast<short*>(weights0.data()) };
+        float* wf{ reinterpret_cast<float*>(&ws[4 * 64]) };
+        double mean[4]{ 0.0, 0.0, 0.0, 0.0 };
+
+        // Calculate mean weight of each first layer neuron
+        for (int j{ 0 }; j < 4; ++j)
+        {
+            double cmean{ 0.0 };
+
+            for (int k{ 0 }; k < 64; ++k)
+                cmean += bdw[offt[j * 64 + k]];
+
+            mean[j] = cmean / 64.0;
+        }
+
+        const double half{ peak / 2.0 };
+
+        // Factor mean removal and 1.0/half scaling into first layer weights. scale to int16 range
+        for (int j{ 0 }; j < 4; ++j)
+        {
+            double mval{ 0.0 };
+            for (int k{ 0 }; k < 64; ++k)
+                mval = std::max(mval, std::abs((bdw[offt[j * 64 + k]] - mean[j]) / half));
+
+            const double scale{ 32767.0 / mval };
+
+            for (int k{ 0 }; k < 64; ++k)
+                ws[offt[j * 64 + k]] = roundds(((bdw[offt[j * 64 + k]] - mean[j]) / half) * scale);
+
+            wf[j] = static_cast<float>(mval / 32767.0);
+        }
+
+        memcpy(wf + 4, bdw + 4 * 64, (dims0new - 4 * 64) * sizeof(float));
+    }
+    else // using old prescreener
+    {
+        double mean[4]{ 0.0, 0.0, 0.0, 0.0 };
+
+        // Calculate mean weight of each first layer neuron
+        for (int j{ 0 }; j < 4; ++j)
+        {
+            double cmean{ 0.0 };
+
+            for (int k{ 0 }; k < 48; ++k)
+                cmean += bdata[j * 48 + k];
+
+            mean[j] = cmean / 48.0;
+        }
+
+        const double half{ peak / 2.0 };
+
+        // Factor mean removal and 1.0/half scaling into first layer weights
+        for (int j{ 0 }; j < 4; ++j)
+        {
+            for (int k{ 0 }; k < 48; ++k)
+                weights0[j * 48 + k] = static_cast<float>((bdata[j * 48 + k] - mean[j]) / half);
+        }
+
+        memcpy(weights0.data() + 4 * 48, bdata.data() + 4 * 48, (dims0 - 4 * 48) * sizeof(float));
+    }
+
+    // Adjust prediction weights
+    for (int i{ 0 }; i < 2; ++i)
+    {
+        const float* bdataT{ bdata.data() + dims0 + dims0new * 3 + dims1tsize * etype + dims1offset + i * dims1 };
+        float* weightsT{ weights1.data() + i * dims1 };
+        const int nnst{ nnsTable[nns] };
+        const int asize{ xdiaTable[nsize] * ydiaTable[nsize] };
+        const int boff{ nnst * 2 * asize };
+        std::vector<double> mean(asize + 1 + nnst * 2);
+
+        // Calculate mean weight of each neuron (ignore bias)
+        for (int j{ 0 }; j < nnst * 2; ++j)
+        {
+            double cmean{ 0.0 };
+
+            for (int k{ 0 }; k < asize; ++k)
+                cmean += bdataT[j * asize + k];
+
+            mean[asize + 1 + j] = cmean / asize;
+        }
+
+        // Calculate mean softmax neuron
+        for (int j{ 0 }; j < nnst; ++j)
+        {
+            for (int k{ 0 }; k < asize; ++k)
+                mean[k] += bdataT[j * asize + k] - mean[asize + 1 + j];
+
+            mean[asize] += bdataT[boff + j];
+        }
+
+        for (int j{ 0 }; j < asize + 1; ++j)
+            mean[j] /= nnst;
+
+        // Factor mean removal into weights, and remove global offset from softmax neurons
+        for (int j{ 0 }; j < nnst * 2; ++j)
+        {
+            for (int k{ 0 }; k < asize; ++k)
+            {
+                const double q{ (j < nnst) ? mean[k] : 0.0 };
+                weightsT[j * asize + k] = static_cast<float>(bdataT[j * asize + k] - mean[asize + 1 + j] - q);
+            }
+
+            weightsT[boff + j] = static_cast<float>(bdataT[boff + j] - (j < nnst ? mean[asize] : 0.0));
+        }
+    }
+
+    const int xdia{ xdiaTable[nsize] };
+    const int ydia{ ydiaTable[nsize] };
+    const int asize{ xdiaTable[nsize] * ydiaTable[nsize] };
+    const int xdiad2m1{ std::max(xdia, (pscrn == 1) ? 12 : 16) / 2 - 1 };
+    const int ydiad2m1{ ydia / 2 - 1 };
+    const int xOffset{ (xdia == 8) ? (pscrn == 1 ? 2 : 4) : 0 };
+    const int inputWidth{ std::max(xdia, (pscrn == 1) ? 12 : 16) + 32 - 1 };
+    const int inputHeight{ ydia + 16 - 1 };
+    const float scaleAsize{ 1.0f / asize };
+    const float scaleQual{ 1.0f / qual };
+
+    const bool intDot{ pquant == 2 && has_int_dot(device) };
+    // Size in bytes of the quantized weights of one predictor and of the whole per-predictor block (weights, scales, biases).
+    const int qwsize{ nnsTable[nns] * 2 * asize * ((pquant == 1) ? 2 : 1) };
+    const int qblock{ qwsize + nnsTable[nns] * 2 * 2 * static_cast<int>(sizeof(float)) };
+
+    d->weights0 = boost::compute::buffer{ context, std::max(dims0, dims0new) * sizeof(cl_float), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights0.data() };
+
+    if (pquant)
+    {
+        const int nnst2{ nnsTable[nns] * 2 };
+        const int boff{ nnst2 * asize };
+        std::vector<uint8_t> weights1q(static_cast<size_t>(qblock) * 2);
+
+        // Quantize every predictor neuron with its own scale. For int16 the scale is further limited so that
+        // 255 * sum(|w|) fits the int32 accumulator of the kernel.
+        for (int i{ 0 }; i < 2; ++i)
+        {
+            const float* weightsT{ weights1.data() + i * dims1 };
+            uint8_t* block{ weights1q.data() + i * qblock };
+            float* wf{ reinterpret_cast<float*>(block + qwsize) };
+
+            for (int j{ 0 }; j < nnst2; ++j)
+            {
+                double mval{ 0.0 };
+                double asum{ 0.0 };
+
+                for (int k{ 0 }; k < asize; ++k)
+                {
+                    mval = std::max(mval, std::abs(static_cast<double>(weightsT[j * asize + k])));
+                    asum += std::abs(weightsT[j * asize + k]);
+                }
+
+                const double scale{ (mval > 0.0) ? ((pquant == 1) ? std::min(32767.0 / mval, (INT_MAX / 255 - asize) / asum) : 127.0 / mval) : 0.0 };
+
+                for (int k{ 0 }; k < asize; ++k)
+                {
+                    const int q{ roundds(weightsT[j * asize + k] * scale) };
+
+                    if (pquant == 1)
+                        reinterpret_cast<int16_t*>(block)[j * asize + k] = static_cast<int16_t>(q);
+                    else
+                        reinterpret_cast<int8_t*>(block)[j * asize + k] = static_cast<int8_t>(std::clamp(q, -127, 127));
+                }
+
+                wf[j] = (mval > 0.0) ? static_cast<float>(1.0 / scale) : 0.0f;
+                wf[nnst2 + j] = weightsT[boff + j];
+            }
+        }
+
+        d->weights1Buffer = boost::compute::buffer{ context, static_cast<size_t>(qblock) * 2, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights1q.data() };
+    }
+    else
+        d->weights1Buffer = boost::compute::buffer{ context, dims1 * 2 * sizeof(cl_float), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights1.data() };
+
+    d->reserved = d->weights0.size() + d->weights1Buffer.size();
+    d->pool->reserve(d->reserved);
+
+    if (!pquant && static_cast<size_t>(dims1 * 2) > device.get_info<size_t>(CL_DEVICE_IMAGE_MAX_BUFFER_SIZE))
+        throw std::string{ "the device's image max buffer size is too small. Reduce nsize/nns...or buy a new graphics card" };
+
+    boost::compute::program program;
+    try
+    {
+        std::ostringstream options;
+        options.imbue(std::locale{ "C" });
+        options.precision(16);
+        options.setf(std::ios::fixed, std::ios::floatfield);
+        options << "-cl-denorms-are-zero -cl-fast-relaxed-math -Werror";
+        options << " -D QUAL=" << qual;
+        if (pscrn == 1)
+        {
+            options << " -D PRESCREEN=prescreenOld";
+            options << " -D USE_OLD_PSCRN=1";
+            options << " -D USE_NEW_PSCRN=0";
+        }
+        else
+        {
+            options << " -D PRESCREEN=prescreenNew";
+            options << " -D USE_OLD_PSCRN=0";
+            options << " -D USE_NEW_PSCRN=1";
+        }
+        options << " -D PSCRN_OFFSET=" << (pscrn == 1 ? 5 : 6);
+        options << " -D DIMS1=" << dims1;
+        options << " -D NNS=" << nnsTable[nns];
+        options << " -D NNS2=" << (nnsTable[nns] * 2);
+        options << " -D XDIA=" << xdia;
+        options << " -D YDIA=" << ydia;
+        options << " -D ASIZE=" << asize;
+        options << " -D XDIAD2M1=" << xdiad2m1;
+        options << " -D YDIAD2M1=" << ydiad2m1;
+        options << " -D X_OFFSET=" << xOffset;
+        options << " -D INPUT_WIDTH=" << inputWidth;
+        options << " -D INPUT_HEIGHT=" << inputHeight;
+        options << " -D SCALE_ASIZE=" << scaleAsize << "f";
+        options << " -D SCALE_QUAL=" << scaleQual << "f";
+        options << " -D PEAK=" << peak;
+        options << " -D PQUANT=" << pquant;
+        options << " -D QWSIZE=" << qwsize;
+        options << " -D QBLOCK=" << qblock;
+        options << " -D INT_DOT=" << intDot;
+        options << " -D MASK=" << d->mask;
+        options << " -D PACKED_T=" << ((bits > 8) ? "ushort" : "uchar");
+        if (!(d->dh || d->dw))
+        {
+            options << " -D Y_OFFSET=" << (ydia - 1);
+            options << " -D Y_STEP=2";
+            options << " -D Y_STRIDE=32";
+        }
+        else
+        {
+            options << " -D Y_OFFSET=" << (ydia / 2);
+            options << " -D Y_STEP=1";
+            options << " -D Y_STRIDE=16";
+        }
+
+        program = boost::compute::program::build_with_source(source, context, options.str());
+    }
+    catch (const boost::compute::opencl_error& error)
+    {
+        throw error.error_string() + "\n" + program.build_log();
+    }
+
+    d->kernel = program.create_kernel((is_float) ? "filter_float" : "filter_uint");
+
+    if (d->packed)
+    {
+        d->unpack_kernel = program.create_kernel("unpack");
+        d->pack_kernel = program.create_kernel("pack");
+    }
+
+    d->width = params->width;
+    d->height = params->height;
+
+    // Output pixels read by the center shift correction around the output pixel.
+    int shift_reach{ 0 };
+
+    if (params->cshift && params->cshift[0])
+    {
+        const ShiftFilter* filter{ std::find_if(std::begin(shiftFilters), std::end(shiftFilters), [&](const ShiftFilter& f) { return !strcmp(f.name, params->cshift); }) };
+        if (filter == std::end(shiftFilters))
+            throw std::string{ "cshift must be point, bilinear, bicubic, lanczos, lanczos4, spline16, spline36 or spline64" };
+
+        d->cshift = true;
+        d->shift_kernel[0] = program.create_kernel((is_float) ? "shift_h_float" : "shift_h_uint");
+        d->shift_kernel[1] = program.create_kernel((is_float) ? "shift_v_float" : "shift_v_uint");
+
+        for (int i{ 0 }; i < 2; ++i)
+        {
+            d->shift[i][0] = params->shift_x[i];
+            d->shift[i][1] = params->shift_y[i];
+
+            for (int j{ 0 }; j < 2; ++j)
+            {
+                std::vector<float> weights{ shift_weights(*filter, d->shift[i][j], d->shift_offset[i][j]) };
+                d->shift_taps[i][j] = static_cast<int>(weights.size());
+                shift_reach = std::max({ shift_reach, std::abs(d->shift_offset[i][j]), std::abs(d->shift_offset[i][j] + d->shift_taps[i][j] - 1) });
+                d->shift_weights[i][j] = boost::compute::buffer{ context, weights.size() * sizeof(cl_float), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, weights.data() };
+            }
+        }
+    }
+
+    d->st = (params->st > -1) ? !!params->st : !!(device.get_info<CL_DEVICE_QUEUE_ON_HOST_PROPERTIES>() & 1);
+
+    cl_image_format imageFormat;
+
+    if (is_float)
+        imageFormat = { CL_R, CL_FLOAT };
+    else if (bits > 8)
+        imageFormat = { CL_R, CL_UNSIGNED_INT16 };
+    else
+        imageFormat = { CL_R, CL_UNSIGNED_INT8 };
+
+    d->bytes_per_sample = (is_float) ? 4 : (bits > 8) ? 2 : 1;
+
+    // Every kernel reads at most max(xdia, 16) / 2 + ydia source pixels around the output pixel in either direction
+    // (the dh + dw pair of passes included). Rounded to 8 to keep the tile origins aligned.
+    // The center shift correction adds shift_reach output pixels (no more source pixels than that).
+    d->halo = (std::max(xdia, 16) + 2 * ydia + 8 + shift_reach + 7) & -8;
+
+    // YUY2 frames are tiled in luma pixels, so the half-width chroma needs twice the halo and tile origins that are multiples of 16.
+    const int tile_align{ (d->packed == NNEDI3CL_PACKED_YUY2) ? 16 : 8 };
+    d->halo *= tile_align / 8;
+
+    const size_t max_image_width{ device.get_info<size_t>(CL_DEVICE_IMAGE2D_MAX_WIDTH) };
+    const size_t max_image_height{ device.get_info<size_t>(CL_DEVICE_IMAGE2D_MAX_HEIGHT) };
+    const cl_ulong max_alloc{ device.get_info<cl_ulong>(CL_DEVICE_MAX_MEM_ALLOC_SIZE) };
+    const cl_ulong budget{ d->pool->budget() };
+
+    // Whether num_sets working sets for a width x height source fit the image limits and the memory budget.
+    auto fits = [&](const size_t width, const size_t height, const int num_sets)
+    {
+        const size_t dst_width{ width << d->dw };
+        const size_t dst_height{ height << d->dh };
+
+        if (dst_width > max_image_width || dst_height > max_image_height)
+            return false;
+
+        const cl_ulong src_bytes{ static_cast<cl_ulong>(width) * height * d->bytes_per_sample };
+        const cl_ulong dst_bytes{ static_cast<cl_ulong>(dst_width) * dst_height * d->bytes_per_sample };
+        const cl_ulong tmp_bytes{ (d->dh && d->dw) ? static_cast<cl_ulong>(dst_width) * height * d->bytes_per_sample : 0 };
+        const cl_ulong shift_bytes{ (d->cshift) ? static_cast<cl_ulong>(dst_width) * dst_height * sizeof(cl_float) : 0 };
+        const cl_ulong mask_bytes{ (d->mask) ? src_bytes : 0 };
+        const cl_ulong packed_src_bytes{ src_bytes * d->packed_step };
+        const cl_ulong packed_dst_bytes{ dst_bytes * d->packed_step };
+
+        if (std::max({ src_bytes, dst_bytes, tmp_bytes, shift_bytes, packed_src_bytes, packed_dst_bytes }) > max_alloc)
+            return false;
+
+        return (src_bytes + dst_bytes + tmp_bytes + shift_bytes + mask_bytes + packed_src_bytes + packed_dst_bytes) * num_sets <= budget;
+    };
+
+    if (params->tile < 0 || (params->tile > 0 && params->tile < 64))
+        throw std::string{ "tile must be 0 or at least 64" };
+
+    d->tile = params->tile & -tile_align;
+
+    if (!d->tile && !fits(params->width, params->height, 1))
+    {
+        for (d->tile = 4096; d->tile > 64; d->tile >>= 1)
+        {
+            if (fits(std::min(d->tile + 2 * d->halo, params->width), std::min(d->tile + 2 * d->halo, params->height), 2))
+                break;
+        }
+    }
+
+    if (d->tile >= std::max(params->width, params->height))
+        d->tile = 0;
+
+    // A user-provided tile (or the smallest automatic one) must fit as well, otherwise the first lease would fail.
+    if (d->tile && !fits(std::min(d->tile + 2 * d->halo, params->width), std::min(d->tile + 2 * d->halo, params->height), 2))
+        throw std::string{ "tile doesn't fit the device image size limits, max allocation size or memory budget. Use a smaller tile" };
+    if (!d->tile && !fits(params->width, params->height, 1))
+        throw std::string{ "the plane doesn't fit the device image size limits, max allocation size or memory budget. Use tile" };
+
+    const size_t ws_width{ static_cast<size_t>((d->tile) ? std::min(d->tile + 2 * d->halo, params->width) : params->width) };
+    const size_t ws_height{ static_cast<size_t>((d->tile) ? std::min(d->tile + 2 * d->halo, params->height) : params->height) };
+
+    if (d->tile)
+        d->queue[1] = boost::compute::command_queue{ context, device };
+
+    for (int i{ 0 }; i < ((d->tile) ? 2 : 1); ++i)
+    {
+        // With packed frames the source plane is written by the unpack kernel instead of the host.
+        d->ws_desc.push_back({ ws_width, ws_height, static_cast<size_t>(d->bytes_per_sample), imageFormat,
+            (d->packed) ? CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS : CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY });
+        d->ws_desc.push_back({ ws_width << d->dw, ws_height << d->dh, static_cast<size_t>(d->bytes_per_sample), imageFormat, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY });
+
+        if (d->dh && d->dw)
+            d->ws_desc.push_back({ ws_width << d->dw, ws_height, static_cast<size_t>(d->bytes_per_sample), imageFormat, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS });
+
+        if (d->cshift)
+            d->ws_desc.push_back({ ws_width << d->dw, ws_height << d->dh, sizeof(cl_float), { CL_R, CL_FLOAT }, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS });
+
+        if (d->mask)
+            d->ws_desc.push_back({ ws_width, ws_height, static_cast<size_t>(d->bytes_per_sample), imageFormat, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY });
+
+        if (d->packed)
+        {
+            d->ws_desc.push_back({ ws_width * d->packed_step, ws_height, static_cast<size_t>(d->bytes_per_sample), {}, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, true });
+            d->ws_desc.push_back({ (ws_width << d->dw) * d->packed_step, ws_height << d->dh, static_cast<size_t>(d->bytes_per_sample), {},
+                CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, true });
+        }
+    }
+
+    if (pquant)
+    {
+        // The quantized predictor reads the buffer directly.
+        clRetainMemObject(d->weights1Buffer.get());
+        d->weights1 = d->weights1Buffer.get();
+    }
+    else
+    {
+        constexpr cl_image_format format{ CL_R, CL_FLOAT };
+
+        cl_image_desc desc;
+        desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
+        desc.image_width = dims1 * 2;
+        desc.image_height = 1;
+        desc.image_depth = 1;
+        desc.image_array_size = 0;
+        desc.image_row_pitch = 0;
+        desc.image_slice_pitch = 0;
+        desc.num_mip_levels = 0;
+        desc.num_samples = 0;
+#ifdef BOOST_COMPUTE_CL_VERSION_2_0
+        desc.mem_object = d->weights1Buffer.get();
+#else
+        desc.buffer = d->weights1Buffer.get();
+#endif
+
+        cl_int error{ 0 };
+
+        cl_mem mem{ clCreateImage(context, 0, &format, &desc, nullptr, &error) };
+        if (!mem)
+            BOOST_THROW_EXCEPTION(boost::compute::opencl_error(error));
+
+        d->weights1 = mem;
+    }
+
+    return d.release();
+}
+
+NNEDI3CL_Context* nnedi3cl_create(const NNEDI3CL_Params* params, char* err, size_t err_size)
+{
+    NNEDI3CL_Context* d{ nullptr };
+    guarded_err(err, err_size, [&]() { d = create(params); });
+
+    return d;
+}
+
+void nnedi3cl_free(NNEDI3CL_Context* ctx)
+{
+    delete ctx;
+}
+
+const char* nnedi3cl_get_error(const NNEDI3CL_Context* ctx)
+{
+    return ctx->err.c_str();
+}
+
+cl_context nnedi3cl_get_cl_context(const NNEDI3CL_Context* ctx)
+{
+    return ctx->queue[0].get_context().get();
+}
+
+cl_command_queue nnedi3cl_get_cl_queue(const NNEDI3CL_Context* ctx)
+{
+    return ctx->queue[0].get();
+}
+
+int nnedi3cl_process_plane(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int src_width, int src_height, void* dstp,
+    ptrdiff_t dst_pitch, int field_n, int shift_set)
+{
+    return guarded(ctx, [&]() { submit_plane(ctx, srcp, src_pitch, nullptr, 0, src_width, src_height, dstp, dst_pitch, field_n, shift_set, true); });
+}
+
+int nnedi3cl_submit_plane(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int src_width, int src_height, void* dstp,
+    ptrdiff_t dst_pitch, int field_n, int shift_set)
+{
+    return guarded(ctx, [&]() { submit_plane(ctx, srcp, src_pitch, nullptr, 0, src_width, src_height, dstp, dst_pitch, field_n, shift_set, false); });
+}
+
+int nnedi3cl_process_packed(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int width, int height, void* dstp, ptrdiff_t dst_pitch, int field_n)
+{
+    return guarded(ctx, [&]() { submit_packed(ctx, srcp, src_pitch, width, height, dstp, dst_pitch, field_n, true); });
+}
+
+int nnedi3cl_submit_packed(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int width, int height, void* dstp, ptrdiff_t dst_pitch, int field_n)
+{
+    return guarded(ctx, [&]() { submit_packed(ctx, srcp, src_pitch, width, height, dstp, dst_pitch, field_n, false); });
+}
+
+int nnedi3cl_process_plane_masked(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, const void* maskp, ptrdiff_t mask_pitch, int src_width,
+    int src_height, void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set)
+{
+    return guarded(ctx, [&]() { submit_plane(ctx, srcp, src_pitch, maskp, mask_pitch, src_width, src_height, dstp, dst_pitch, field_n, shift_set, true); });
+}
+
+int nnedi3cl_submit_plane_masked(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, const void* maskp, ptrdiff_t mask_pitch, int src_width,
+    int src_height, void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set)
+{
+    return guarded(ctx, [&]() { submit_plane(ctx, srcp, src_pitch, maskp, mask_pitch, src_width, src_height, dstp, dst_pitch, field_n, shift_set, false); });
+}
+
+int nnedi3cl_wait(NNEDI3CL_Context* ctx)
+{
+    return guarded(ctx, [&]() { drain(ctx); });
+}
+
+int nnedi3cl_process_plane_mem(NNEDI3CL_Context* ctx, cl_mem src, cl_mem dst, int src_width, int src_height, int field_n, int shift_set)
+{
+    return guarded(ctx, [&]()
+        {
+            if (ctx->mask || ctx->packed)
+                throw std::string{ "masked processing and packed frames are not supported for cl_mem planes" };
+            if (shift_set < 0 || shift_set > 1)
+                throw std::string{ "shift_set must be 0 or 1" };
+            // The tmp and shift images of the working set are sized for the frame size of the context.
+            if (src_width < 1 || src_height < 1 || src_width > ctx->width || src_height > ctx->height)
+                throw std::string{ "the plane must be at least 1x1 and not larger than the frame size of the context" };
+
+            boost::compute::image2d src_image{ src };
+            boost::compute::image2d dst_image{ dst };
+
+            // Untiled, the kernels run on the caller's images directly, so only tmp and shift are leased.
+            lease(ctx, ctx->tile != 0);
+
+            if (!ctx->tile)
+            {
+                WorkingSet ws{ src_image, dst_image, ctx->ws[0].tmp, ctx->ws[0].shift };
+                enqueue_plane(ctx, ctx->queue[0], ws, src_width, src_height, field_n, shift_set);
+                return;
+            }
+
+            auto upload = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int x, const int y, const int width, const int height)
+            {
+                queue.enqueue_copy_image(src_image, ws.src, boost::compute::dim(x, y), boost::compute::dim(0, 0), boost::compute::dim(width, height));
+            };
+
+            auto download = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int x, const int y, const int dst_x, const int dst_y,
+                const int width, const int height)
+            {
+                queue.enqueue_copy_image(ws.dst, dst_image, boost::compute::dim(x, y), boost::compute::dim(dst_x, dst_y), boost::compute::dim(width, height));
+            };
+
+            auto process = [&](boost::compute::command_queue& queue, WorkingSet& ws, const int width, const int height, int, int, int, int)
+            {
+                enqueue_plane(ctx, queue, ws, width, height, field_n, shift_set);
+            };
+
+            process_tiles(ctx, src_width, src_height, upload, process, download);
+
+            // Keep the queue returned by nnedi3cl_get_cl_queue the only one the caller has to synchronize with.
+            ctx->queue[0].enqueue_barrier(boost::compute::wait_list{ ctx->queue[1].enqueue_marker() });
+        });
+}
@@ -0,0 +1,136 @@
+#ifndef NNEDI3CL_CORE_H
+#define NNEDI3CL_CORE_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct NNEDI3CL_Context NNEDI3CL_Context;
+
+/* Layouts of the interleaved frames accepted by nnedi3cl_process_packed/nnedi3cl_submit_packed. */
+#define NNEDI3CL_PACKED_YUY2 1 /* Y0 U Y1 V, 8-bit */
+#define NNEDI3CL_PACKED_BGR  2 /* B G R (RGB24/RGB48) */
+#define NNEDI3CL_PACKED_BGRA 3 /* B G R A (RGB32/RGB64) */
+
+typedef struct NNEDI3CL_Params
+{
+    int width;                /* largest source plane width that will be processed */
+    int height;               /* largest source plane height that will be processed */
+    int bits_per_sample;      /* 8..16 for integer samples, 32 for float samples */
+    int dh;
+    int dw;
+    int nsize;
+    int nns;
+    int qual;
+    int etype;
+    int pscrn;                /* -1: 2 for integer samples, 1 for float samples */
+    int pquant;               /* predictor weights: 0: float, 1: int16, 2: int8 (8-bit samples only) */
+    int device;               /* -1: default device */
+    int st;                   /* -1: auto determined by device properties */
+    int tile;                 /* 0: tile only when the plane doesn't fit the device, otherwise the tile size in source pixels (>= 64) */
+    int fission;              /* 0: whole device, > 0: run on a sub-device of that many compute units, -1: run on a sub-device per affinity domain (e.g. NUMA node) */
+    int packed;               /* 0: planar, otherwise NNEDI3CL_PACKED_* (use the packed functions) */
+    int mask;                 /* process only where a mask is non-zero (use the masked functions). Elsewhere 1: keep the original lines, 2: interpolate. Requires dh = dw = 0 */
+    const char* cshift;       /* center shift correction applied on the device: NULL: none, point, bilinear, bicubic, lanczos, lanczos4, spline16, spline36 or spline64 */
+    double shift_x[2];        /* shifts (in output pixels) resampled by cshift, indexed by the shift_set of each call. YUY2 chroma uses [1] */
+    double shift_y[2];
+    const char* weights_path; /* NULL: nnedi3_weights.bin next to the module */
+} NNEDI3CL_Params;
+
+typedef struct NNEDI3CL_MemoryStats
+{
+    unsigned long long budget;    /* bytes */
+    unsigned long long allocated; /* bytes of images and weights currently allocated by all contexts on the device */
+    unsigned long long peak;      /* highest value of allocated so far */
+    unsigned long long waits;     /* number of times a context waited for memory of another one */
+} NNEDI3CL_MemoryStats;
+
+/* Fills params with the same defaults the AviSynth filter uses. width, height and bits_per_sample must still be set. */
+void nnedi3cl_default_params(NNEDI3CL_Params* params);
+
+/* Returns the number of OpenCL devices in the system. */
+int nnedi3cl_device_count(void);
+
+/* Writes one "index: name (platform)" line per device into buf (truncated to size - 1 characters).
+   Returns 0 on success. On failure buf holds the error message. */
+int nnedi3cl_list_devices(char* buf, size_t size);
+
+/* Writes the platform and device properties of device (-1: default device) into buf (truncated to size - 1 characters).
+   Returns 0 on success. On failure buf holds the error message. */
+int nnedi3cl_device_info(int device, char* buf, size_t size);
+
+/* All contexts on one device (-1: default device) share one OpenCL context and a pool of working-set images limited by a process-wide budget.
+   When a frame would exceed the budget, it waits for the images of other contexts instead of failing.
+   bytes = 0 restores the default (3/4 of the device memory). Returns 0 on success. On failure err holds the error message. */
+int nnedi3cl_set_memory_budget(int device, unsigned long long bytes, char* err, size_t err_size);
+
+/* Returns 0 on success. */
+int nnedi3cl_get_memory_stats(int device, NNEDI3CL_MemoryStats* stats);
+
+/* Loads the weights, builds the kernel and allocates the device images.
+   With fission, the device is partitioned by the first context created on it. All contexts that exist on the device at the same time must use the same fission.
+   The partition is dropped when the last context on the device is freed.
+   Returns NULL on failure, in which case err (if not NULL) holds the error message. */
+NNEDI3CL_Context* nnedi3cl_create(const NNEDI3CL_Params* params, char* err, size_t err_size);
+
+void nnedi3cl_free(NNEDI3CL_Context* ctx);
+
+/* Returns the message of the last failed call on ctx. */
+const char* nnedi3cl_get_error(const NNEDI3CL_Context* ctx);
+
+/* Returns the OpenCL context and the in-order command queue used by ctx.
+   cl_mem handles passed to nnedi3cl_process_plane_mem must belong to this context. */
+cl_context nnedi3cl_get_cl_context(const NNEDI3CL_Context* ctx);
+cl_command_queue nnedi3cl_get_cl_queue(const NNEDI3CL_Context* ctx);
+
+/* Processes one plane between caller-provided pitched host buffers and blocks until dstp is filled.
+   On failure it returns only after the work already enqueued has completed, so srcp and dstp can be freed right away.
+   The destination plane is (src_width << dw) x (src_height << dh) samples.
+   field_n is the field that is kept (0: bottom, 1: top).
+   shift_set selects the cshift shifts applied to the plane (0: shift_x[0]/shift_y[0], 1: shift_x[1]/shift_y[1], e.g. for subsampled chroma).
+   All functions returning int return 0 on success. */
+int nnedi3cl_process_plane(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int src_width, int src_height,
+    void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set);
+
+/* Same as nnedi3cl_process_plane, but only enqueues the work. srcp and dstp must stay valid until nnedi3cl_wait returns.
+   Several planes may be submitted before waiting. */
+int nnedi3cl_submit_plane(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int src_width, int src_height,
+    void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set);
+
+/* Same as nnedi3cl_process_plane/nnedi3cl_submit_plane for a context created with mask. maskp is a plane of the source size and sample format.
+   Only the groups of 8 output pixels with a non-zero mask pixel on the interpolated line are processed by the neural network. */
+int nnedi3cl_process_plane_masked(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, const void* maskp, ptrdiff_t mask_pitch, int src_width,
+    int src_height, void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set);
+int nnedi3cl_submit_plane_masked(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, const void* maskp, ptrdiff_t mask_pitch, int src_width,
+    int src_height, void* dstp, ptrdiff_t dst_pitch, int field_n, int shift_set);
+
+/* Processes one interleaved frame of a context created with packed. Each tile of the frame is uploaded once and split into the components
+   (YUY2: width x height Y and (width / 2) x height U, V) on the device. The results are interleaved again on the device.
+   A negative pitch means the rows are stored bottom-up and the pointer points to the top row (e.g. AviSynth RGB frames).
+   nnedi3cl_process_packed blocks until dstp is filled. nnedi3cl_submit_packed only enqueues the work (see nnedi3cl_submit_plane). */
+int nnedi3cl_process_packed(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int width, int height, void* dstp, ptrdiff_t dst_pitch, int field_n);
+int nnedi3cl_submit_packed(NNEDI3CL_Context* ctx, const void* srcp, ptrdiff_t src_pitch, int width, int height, void* dstp, ptrdiff_t dst_pitch, int field_n);
+
+/* Blocks until all work submitted on ctx has completed. */
+int nnedi3cl_wait(NNEDI3CL_Context* ctx);
+
+/* Enqueues processing of one plane between existing single-channel image2d objects of the sample format used by ctx. Not supported with mask.
+   src_width x src_height must not exceed the frame size of ctx. dst must be at least (src_width << dw) x (src_height << dh).
+   Without tile the kernels run on src and dst directly and only the intermediate images are leased from the device pool.
+   The working-set images stay leased from the device pool until nnedi3cl_wait, so nnedi3cl_wait must be called after the work
+   (synchronizing only on the queue doesn't return them and other contexts on the device may block waiting for memory). */
+int nnedi3cl_process_plane_mem(NNEDI3CL_Context* ctx, cl_mem src, cl_mem dst, int src_width, int src_height, int field_n, int shift_set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NNEDI3CL_CORE_H